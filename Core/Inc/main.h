@@ -57,8 +57,12 @@ void Error_Handler(void);
 /* USER CODE END EFP */
 
 /* Private defines -----------------------------------------------------------*/
+#define CAPTURE_TRIG_Pin GPIO_PIN_0
+#define CAPTURE_TRIG_GPIO_Port GPIOA
+#define CAPTURE_TRIG_EXTI_IRQn EXTI0_IRQn
 #define LIMIT_Pin GPIO_PIN_4
 #define LIMIT_GPIO_Port GPIOA
+#define LIMIT_EXTI_IRQn EXTI4_IRQn
 #define CS_PIN_Pin GPIO_PIN_0
 #define CS_PIN_GPIO_Port GPIOB
 #define SCH_DRY_Pin GPIO_PIN_1
@@ -81,6 +85,7 @@ void Error_Handler(void);
 #define MOTOR_STEP_GPIO_Port GPIOB
 #define MOTOR_FLT_Pin GPIO_PIN_7
 #define MOTOR_FLT_GPIO_Port GPIOB
+#define MOTOR_FLT_EXTI_IRQn EXTI9_5_IRQn
 
 /* USER CODE BEGIN Private defines */
 
@@ -43,6 +43,8 @@ extern TIM_HandleTypeDef htim4;
 void MX_TIM2_Init(void);
 void MX_TIM4_Init(void);
 
+void HAL_TIM_MspPostInit(TIM_HandleTypeDef *htim);
+
 /* USER CODE BEGIN Prototypes */
 
 /* USER CODE END Prototypes */
@@ -0,0 +1,212 @@
+/* Allan.c
+ * Allan deviation of the Rate1 and Acc1 axes, accumulated on the device
+ * over runs of any length with fixed RAM.
+ *
+ * Samples are summed into level 0 clusters of 2^baseShift samples. Every
+ * level keeps the previous cluster mean and adds the squared difference
+ * of consecutive means to a 64-bit sum; every second cluster is paired
+ * with the one before it into a cluster of the next level. The cascade
+ * costs two level updates per cluster on average, independent of the run
+ * length. Means are kept in Q8 as offsets from the first sample, so the
+ * deep levels keep their resolution in 32 bits.
+ *
+ * AVAR(tau) = sum((m[i+1] - m[i])^2) / (2 * differences). Runs in the
+ * sample handler, and so does the report: one level is finished per sample
+ * (one square root), and the channel packet goes out when the link has
+ * room. No state is shared with an interrupt.
+ */
+
+#include "Allan.h"
+#include "Protocol.h"
+#include "Link.h"
+#include "Cordic.h"
+#include "SampleRate.h"
+
+#define ALLAN_QUALITY_BITS  (SCH_QUALITY_RATE1_X | SCH_QUALITY_RATE1_Y | SCH_QUALITY_RATE1_Z | \
+                             SCH_QUALITY_ACC1_X | SCH_QUALITY_ACC1_Y | SCH_QUALITY_ACC1_Z)
+
+typedef struct {
+    int32_t  previous;          // Previous cluster mean, Q8
+    int32_t  half;              // First cluster of the pair for the next level, Q8
+    uint64_t sumSquares;        // Sum of squared mean differences, Q16
+} AllanCell;
+
+static AllanCell cells[ALLAN_LEVELS][ALLAN_CHANNELS];
+static uint32_t clusters[ALLAN_LEVELS];
+static uint16_t saturated = 0;          // Bit per level
+static int64_t baseSum[ALLAN_CHANNELS]; // Level 0 cluster being summed, LSB
+static uint32_t baseSamples = 0;
+static int32_t reference[ALLAN_CHANNELS];
+static uint32_t samples = 0;
+static uint16_t skipped = 0;
+static uint16_t sampleRate = 0;
+static uint8_t baseShift = 0;
+static bool running = false;
+
+// Report in progress
+static PktAllan report;
+static int8_t reportChannel = -1;       // -1 = no report
+static uint8_t reportLevel = 0;
+
+/**
+ * Start, stop or report a run. Called from the command handler.
+ */
+int32_t AllanCommand(uint8_t mode, uint8_t shift)
+{
+    switch (mode)
+    {
+        case ALLAN_MODE_STOP:
+            running = false;
+            return SCH_OK;
+
+        case ALLAN_MODE_START:
+            if (shift > ALLAN_MAX_BASE_SHIFT)
+                return SCH_ERR_INVALID_PARAM;
+            for (int level = 0; level < ALLAN_LEVELS; level++)
+            {
+                for (int channel = 0; channel < ALLAN_CHANNELS; channel++)
+                    cells[level][channel].sumSquares = 0;
+                clusters[level] = 0;
+            }
+            for (int channel = 0; channel < ALLAN_CHANNELS; channel++)
+                baseSum[channel] = 0;
+            baseSamples = 0;
+            saturated = 0;
+            samples = 0;
+            skipped = 0;
+            sampleRate = (uint16_t)SampleRateGet();
+            baseShift = shift;
+            running = true;
+            return SCH_OK;
+
+        case ALLAN_MODE_REPORT:
+            reportChannel = 0;
+            reportLevel = 0;
+            return SCH_OK;
+
+        default:
+            return SCH_ERR_INVALID_PARAM;
+    }
+}
+
+/**
+ * Feed one level 0 cluster through the levels. mean[] is overwritten with
+ * the pair means on the way up.
+ */
+static void AllanAddCluster(int32_t *mean)
+{
+    for (int level = 0; level < ALLAN_LEVELS; level++)
+    {
+        uint32_t n = clusters[level]++;
+
+        for (int channel = 0; channel < ALLAN_CHANNELS; channel++)
+        {
+            AllanCell *cell = &cells[level][channel];
+
+            if (n > 0) {
+                int32_t difference = mean[channel] - cell->previous;
+                uint64_t square = (uint64_t)((int64_t)difference * difference);
+
+                if (cell->sumSquares > (UINT64_MAX - square))
+                    saturated |= (uint16_t)(1U << level);
+                else
+                    cell->sumSquares += square;
+            }
+            cell->previous = mean[channel];
+
+            if (n & 1)
+                mean[channel] = (cell->half + mean[channel]) >> 1;
+            else
+                cell->half = mean[channel];
+        }
+
+        // Pair not complete, nothing for the next level
+        if ((n & 1) == 0)
+            break;
+    }
+}
+
+/**
+ * Finish one level of the report, or send the finished channel
+ */
+static void AllanReportStep(void)
+{
+    uint32_t differences;
+
+    if (reportLevel < ALLAN_LEVELS) {
+        differences = (clusters[reportLevel] > 1) ? (clusters[reportLevel] - 1) : 0;
+        report.differences[reportLevel] = differences;
+        report.deviation[reportLevel] = (differences == 0) ? 0 :
+            CordicSqrt(cells[reportLevel][reportChannel].sumSquares / (2ULL * differences));
+        reportLevel++;
+        return;
+    }
+
+    if (LinkTxFree() < (ALLAN_SEND_MIN_FREE + sizeof(report) + LINK_HEADER_SIZE + LINK_CRC_SIZE))
+        return;
+
+    report.samples = samples;
+    report.sampleRate = sampleRate;
+    report.skipped = skipped;
+    report.reserved[0] = 0;
+    report.reserved[1] = 0;
+    report.reserved[2] = 0;
+    report.channel = (uint8_t)reportChannel;
+    report.baseShift = baseShift;
+    report.running = running;
+    report.saturated = saturated;
+    if (!LinkSend(PKT_ALLAN, &report, sizeof(report)))
+        return;
+
+    reportLevel = 0;
+    if (++reportChannel >= ALLAN_CHANNELS)
+        reportChannel = -1;
+}
+
+/**
+ * Add one sample, advance a pending report. Called from the sample
+ * handler.
+ */
+void AllanUpdate(const SCHRawData *data)
+{
+    int32_t values[ALLAN_CHANNELS];
+    int32_t mean[ALLAN_CHANNELS];
+
+    if (reportChannel >= 0)
+        AllanReportStep();
+
+    if (!running)
+        return;
+
+    if (data->quality & ALLAN_QUALITY_BITS) {
+        if (skipped < UINT16_MAX)
+            skipped++;
+        return;
+    }
+
+    values[ALLAN_RATE1_X] = data->rate1Raw[AXIS_X];
+    values[ALLAN_RATE1_Y] = data->rate1Raw[AXIS_Y];
+    values[ALLAN_RATE1_Z] = data->rate1Raw[AXIS_Z];
+    values[ALLAN_ACC1_X]  = data->acc1Raw[AXIS_X];
+    values[ALLAN_ACC1_Y]  = data->acc1Raw[AXIS_Y];
+    values[ALLAN_ACC1_Z]  = data->acc1Raw[AXIS_Z];
+
+    if (samples == 0) {
+        for (int channel = 0; channel < ALLAN_CHANNELS; channel++)
+            reference[channel] = values[channel];
+    }
+    samples++;
+
+    for (int channel = 0; channel < ALLAN_CHANNELS; channel++)
+        baseSum[channel] += values[channel] - reference[channel];
+    if (++baseSamples < (1UL << baseShift))
+        return;
+
+    for (int channel = 0; channel < ALLAN_CHANNELS; channel++)
+    {
+        mean[channel] = (int32_t)((baseSum[channel] * 256) >> baseShift);
+        baseSum[channel] = 0;
+    }
+    baseSamples = 0;
+    AllanAddCluster(mean);
+}
@@ -0,0 +1,51 @@
+#ifndef _ALLAN_H
+#define _ALLAN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "SCHSensor.h"
+
+#define ALLAN_LEVELS                16      // Octaves, cluster of 2^(level + baseShift) samples
+#define ALLAN_MAX_BASE_SHIFT        12      // Level 0 cluster up to 4096 samples
+#define ALLAN_SEND_MIN_FREE         512     // Link TX bytes left free for the sample stream
+
+/**
+ * CMD_ALLAN modes
+ */
+#define ALLAN_MODE_STOP             0   // Stop accumulating, results are kept
+#define ALLAN_MODE_START            1   // Clear and start a run
+#define ALLAN_MODE_REPORT           2   // Send one PKT_ALLAN per channel
+
+/**
+ * Channels, raw sensor counts
+ */
+typedef enum {
+    ALLAN_RATE1_X = 0,
+    ALLAN_RATE1_Y,
+    ALLAN_RATE1_Z,
+    ALLAN_ACC1_X,
+    ALLAN_ACC1_Y,
+    ALLAN_ACC1_Z,
+    ALLAN_CHANNELS
+} AllanChannelId;
+
+/**
+ * PKT_ALLAN payload, one per channel. Non-overlapping Allan deviation at
+ * tau = 2^(level + baseShift) / sampleRate.
+ */
+typedef struct {
+    uint32_t samples;           // Samples accumulated since the start
+    uint16_t sampleRate;        // Hz at the start
+    uint16_t skipped;           // Samples left out for a frame error
+    uint16_t saturated;         // Bit per level, a sum of squares saturated
+    uint8_t  channel;           // AllanChannelId
+    uint8_t  baseShift;
+    uint8_t  running;
+    uint8_t  reserved[3];
+    uint32_t deviation[ALLAN_LEVELS];   // Q8 LSB, 0 = fewer than two clusters
+    uint32_t differences[ALLAN_LEVELS]; // Cluster differences averaged per level
+} PktAllan;
+
+int32_t AllanCommand(uint8_t mode, uint8_t baseShift);
+void    AllanUpdate(const SCHRawData *data);
+#endif
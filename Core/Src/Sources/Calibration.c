@@ -0,0 +1,352 @@
+/* Calibration.c
+ * Rate1 scale factor and bias calibration with the stepper as rate table.
+ *
+ * The motor is run at a table of constant rates in both directions. For
+ * each run the raw gyro axis is summed over the samples in which the motor
+ * made an exact number of steps, so the reference rate is
+ *
+ *   steps * 360 / stepsPerRev / (samples / sample rate)
+ *
+ * and does not depend on the step timer accuracy. A least-squares line
+ * through (reference rate, mean raw output) gives scale factor and bias,
+ * which are applied at once and saved to flash from the housekeeping
+ * event. The flash erase and program stall every instruction fetch, TIM2
+ * interrupt included, so the save leaves a sample gap of tens of ms; it is
+ * counted in PktHealth missedSamples. Runs on the acquisition path like
+ * the rate controller; rate changes are ramped with the motion acceleration.
+ */
+
+#include "Calibration.h"
+#include "Controller.h"
+#include "Homing.h"
+#include "Motion.h"
+#include "Stepper.h"
+#include "ConfigStore.h"
+#include "SampleRate.h"
+#include "Protocol.h"
+#include "Link.h"
+#include "ZeroMotion.h"
+#include <string.h>
+
+static CalibrationState state = CALIBRATION_IDLE;
+static uint8_t run;                     // Run index, positive rates first
+static uint8_t runs;
+static int32_t command;                 // Ramped step rate, steps/s
+static int32_t target;                  // Table rate of the current run, steps/s
+static int32_t rampStep;                // steps/s per sample
+static int32_t minRate;                 // Slowest rate the stepper is commanded to
+static uint16_t settleCount;
+
+// Current run
+static int32_t startPosition;
+static int64_t rawSum;
+static uint32_t samples;
+static uint16_t badSamples;
+static int32_t lastRaw;
+
+// Fit input
+static float reference[CALIBRATION_MAX_RUNS];   // dps
+static float measured[CALIBRATION_MAX_RUNS];    // Mean raw output, LSB
+
+// Result saved and sent by the housekeeping handler
+static PktCalResult result;
+static volatile bool resultReady = false;
+
+void CalibrationLoadDefaults(CalibrationParams *params)
+{
+    params->stepsPerRev = CALIBRATION_DEFAULT_STEPS_PER_REV;
+    params->maxRate     = CALIBRATION_DEFAULT_MAX_RATE;
+    params->windowSteps = CALIBRATION_DEFAULT_WINDOW_STEPS;
+    params->axis        = CALIBRATION_DEFAULT_AXIS;
+    params->points      = CALIBRATION_DEFAULT_POINTS;
+    params->reserved    = 0;
+}
+
+/**
+ * Table rate of a run in steps/s: ascending positive rates, then descending negative
+ */
+static int32_t CalibrationRunRate(uint8_t index)
+{
+    const CalibrationParams *params = &appConfig.calibrationTable;
+    int32_t k = (index < params->points) ? (index + 1) : -(int32_t)(runs - index);
+
+    return (int32_t)(((int64_t)params->maxRate * k * params->stepsPerRev) / (360 * (int32_t)params->points));
+}
+
+/**
+ * Stop the motor and report a failed sequence
+ */
+static void CalibrationFail(void)
+{
+    PktCalResult pkt;
+
+    StepperStop();
+    state = CALIBRATION_FAILED;
+
+    memset(&pkt, 0, sizeof(pkt));
+    pkt.state = (uint8_t)state;
+    pkt.axis = appConfig.calibrationTable.axis;
+    pkt.runs = run;
+    LinkSend(PKT_CAL_RESULT, &pkt, sizeof(pkt));
+}
+
+/**
+ * Advance the ramped rate by one sample. The band below the start velocity,
+ * where DIR changes, is skipped.
+ *
+ * @return true when the table rate is reached
+ */
+static bool CalibrationRamp(void)
+{
+    int32_t next;
+
+    if (command == target)
+        return true;
+
+    if (command < target)
+        next = (command + rampStep < target) ? (command + rampStep) : target;
+    else
+        next = (command - rampStep > target) ? (command - rampStep) : target;
+
+    if ((next > 0) && (next < minRate))
+        next = (next > command) ? minRate : 0;
+    else if ((next < 0) && (next > -minRate))
+        next = (next < command) ? -minRate : 0;
+
+    command = next;
+    if (StepperSetRate(command) != SCH_OK)
+        CalibrationFail();
+
+    return false;
+}
+
+/**
+ * Fit and apply the calibration, report the result
+ */
+static void CalibrationFinish(void)
+{
+    const CalibrationParams *params = &appConfig.calibrationTable;
+    PktCalResult *pkt = &result;
+    float sx = 0.0f, sy = 0.0f, sxx = 0.0f, sxy = 0.0f;
+    float n = (float)runs;
+    float slope;
+    float offset;
+    float denominator;
+
+    for (uint8_t i = 0; i < runs; i++) {
+        sx  += reference[i];
+        sy  += measured[i];
+        sxx += reference[i] * reference[i];
+        sxy += reference[i] * measured[i];
+    }
+
+    denominator = n * sxx - sx * sx;
+    if (denominator <= 0.0f) {
+        CalibrationFail();
+        return;
+    }
+    slope = (n * sxy - sx * sy) / denominator;
+    offset = (sy - slope * sx) / n;
+
+    // No gyro response, wrong axis
+    if (slope == 0.0f) {
+        CalibrationFail();
+        return;
+    }
+
+    memset(pkt, 0, sizeof(*pkt));
+    for (uint8_t i = 0; i < runs; i++)
+        pkt->residual[i] = (measured[i] - offset - slope * reference[i]) / slope;
+
+    // Scale is stored as a magnitude, the sign is the mounting direction
+    appConfig.calibration.rate1Scale[params->axis] = ((slope < 0.0f) ? -slope : slope) / (float)AVG_FACTOR;
+    appConfig.calibration.rate1Bias[params->axis] = (int32_t)((offset < 0.0f) ? (offset - 0.5f) : (offset + 0.5f));
+    SCHSetCalibration(&appConfig.calibration);
+    ControllerConfigure();
+    ZeroMotionReseed();
+    state = CALIBRATION_DONE;
+
+    pkt->state = (uint8_t)state;
+    pkt->axis  = params->axis;
+    pkt->runs  = runs;
+    pkt->scale = slope / (float)AVG_FACTOR;
+    pkt->bias  = appConfig.calibration.rate1Bias[params->axis];
+    resultReady = true;
+}
+
+/**
+ * Close the current run and report it
+ */
+static void CalibrationEndRun(int32_t steps)
+{
+    const CalibrationParams *params = &appConfig.calibrationTable;
+    PktCalPoint pkt;
+    float time = (float)samples / (float)SampleRateGet();
+
+    reference[run] = (float)steps * 360.0f / ((float)params->stepsPerRev * time);
+    measured[run] = (float)rawSum / (float)samples;
+
+    pkt.run        = run;
+    pkt.runs       = runs;
+    pkt.axis       = params->axis;
+    pkt.badSamples = (uint8_t)badSamples;
+    pkt.reference  = reference[run];
+    pkt.measured   = measured[run];
+    pkt.samples    = samples;
+    pkt.steps      = steps;
+    LinkSend(PKT_CAL_POINT, &pkt, sizeof(pkt));
+
+    if (++run < runs) {
+        target = CalibrationRunRate(run);
+        state = CALIBRATION_RAMP;
+    }
+    else {
+        target = 0;
+        state = CALIBRATION_STOPPING;
+    }
+}
+
+/**
+ * @brief Start the rate table sequence.
+ *
+ * @return SCH_OK, SCH_ERR_INVALID_PARAM when the table exceeds the step rate
+ *         range, SCH_ERR_OTHER when the driver is disabled or the motor is in use
+ */
+int32_t CalibrationStart(void)
+{
+    const CalibrationParams *params = &appConfig.calibrationTable;
+    int32_t slowest;
+
+    if (CalibrationIsBusy() || MotionIsBusy() || HomingIsBusy() || ControllerIsEnabled())
+        return SCH_ERR_OTHER;
+    if (!StepperIsEnabled() || StepperIsRunning())
+        return SCH_ERR_OTHER;
+    if ((params->points < 1) || (params->points > CALIBRATION_MAX_POINTS) || (params->axis > AXIS_Z))
+        return SCH_ERR_INVALID_PARAM;
+    if ((params->stepsPerRev < 1) || (params->windowSteps < 1))
+        return SCH_ERR_INVALID_PARAM;
+
+    runs = 2 * params->points;
+    slowest = CalibrationRunRate(0);
+    if ((slowest < 1) || (CalibrationRunRate(params->points - 1) > STEPPER_MAX_RATE))
+        return SCH_ERR_INVALID_PARAM;
+
+    minRate = (appConfig.motion.startVelocity < slowest) ? appConfig.motion.startVelocity : slowest;
+    rampStep = appConfig.motion.acceleration / (int32_t)SampleRateGet();
+    if (rampStep < 1)
+        rampStep = 1;
+
+    run = 0;
+    command = 0;
+    target = slowest;
+    state = CALIBRATION_RAMP;
+
+    return SCH_OK;
+}
+
+/**
+ * Stop the motor and abandon the sequence, calibration is left unchanged
+ */
+void CalibrationAbort(void)
+{
+    if (!CalibrationIsBusy())
+        return;
+
+    StepperStop();
+    state = CALIBRATION_IDLE;
+}
+
+/**
+ * Advance the sequence on an acquired sample
+ */
+void CalibrationUpdate(const SCHRawData *data)
+{
+    uint8_t axis = appConfig.calibrationTable.axis;
+    int32_t steps;
+
+    if (!CalibrationIsBusy())
+        return;
+
+    // Stopped under the sequence: driver disabled, fault or limit switch
+    if ((command != 0) && !StepperIsRunning()) {
+        CalibrationFail();
+        return;
+    }
+
+    switch (state)
+    {
+        case CALIBRATION_RAMP:
+            if (CalibrationRamp()) {
+                settleCount = 0;
+                state = CALIBRATION_SETTLE;
+            }
+            break;
+
+        case CALIBRATION_SETTLE:
+            if (++settleCount < CALIBRATION_SETTLE_SAMPLES)
+                break;
+            startPosition = StepperGetPosition();
+            rawSum = 0;
+            samples = 0;
+            badSamples = 0;
+            lastRaw = data->rate1Raw[axis];
+            state = CALIBRATION_MEASURE;
+            break;
+
+        case CALIBRATION_MEASURE:
+            // Invalid frames are replaced by the last valid sample
+            if (data->quality & (SCH_QUALITY_RATE1_X << axis)) {
+                if (++badSamples > CALIBRATION_MAX_BAD_SAMPLES) {
+                    CalibrationFail();
+                    break;
+                }
+            }
+            else {
+                lastRaw = data->rate1Raw[axis];
+            }
+            rawSum += lastRaw;
+            samples++;
+
+            steps = StepperGetPosition() - startPosition;
+            if (((steps < 0) ? -steps : steps) >= appConfig.calibrationTable.windowSteps)
+                CalibrationEndRun(steps);
+            break;
+
+        case CALIBRATION_STOPPING:
+            if (CalibrationRamp())
+                CalibrationFinish();
+            break;
+
+        default:
+            break;
+    }
+}
+
+/**
+ * Save the applied calibration and send the pending result. Called from
+ * the housekeeping handler, once the sequence has ended; the flash write
+ * still stalls acquisition for tens of ms.
+ */
+void CalibrationSend(void)
+{
+    if (!resultReady)
+        return;
+
+    result.saved = (ConfigSave() == SCH_OK);
+    LinkSend(PKT_CAL_RESULT, &result, sizeof(result));
+    resultReady = false;
+}
+
+CalibrationState CalibrationGetState(void)
+{
+    return state;
+}
+
+/**
+ * Rate table sequence in progress
+ */
+bool CalibrationIsBusy(void)
+{
+    return (state == CALIBRATION_RAMP) || (state == CALIBRATION_SETTLE) ||
+           (state == CALIBRATION_MEASURE) || (state == CALIBRATION_STOPPING);
+}
@@ -0,0 +1,52 @@
+#ifndef _CALIBRATION_H
+#define _CALIBRATION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "SCHsensor.h"
+
+#define CALIBRATION_MAX_POINTS          8       // Rates per direction
+#define CALIBRATION_MAX_RUNS            (2 * CALIBRATION_MAX_POINTS)
+#define CALIBRATION_SETTLE_SAMPLES      500     // Samples at constant rate before integrating
+#define CALIBRATION_MAX_BAD_SAMPLES     10      // Invalid gyro frames tolerated per run
+
+/**
+ * Default rate table: rates maxRate * k / points for k = 1..points, each
+ * run in both directions and integrated over windowSteps steps.
+ */
+#define CALIBRATION_DEFAULT_STEPS_PER_REV   3200    // 200 step motor, 16 microsteps
+#define CALIBRATION_DEFAULT_MAX_RATE        180     // dps
+#define CALIBRATION_DEFAULT_WINDOW_STEPS    3200    // One revolution
+#define CALIBRATION_DEFAULT_POINTS          4
+#define CALIBRATION_DEFAULT_AXIS            AXIS_Z
+
+typedef enum {
+    CALIBRATION_IDLE = 0,
+    CALIBRATION_RAMP,           // Ramping to the next table rate
+    CALIBRATION_SETTLE,
+    CALIBRATION_MEASURE,        // Integrating the gyro over the step window
+    CALIBRATION_STOPPING,       // Ramping down after the last run
+    CALIBRATION_DONE,
+    CALIBRATION_FAILED
+} CalibrationState;
+
+/**
+ * Rate table parameters, part of the persistent configuration
+ */
+typedef struct {
+    int32_t stepsPerRev;        // Steps per turntable revolution
+    int32_t maxRate;            // Highest table rate, dps
+    int32_t windowSteps;        // Steps integrated per run
+    uint8_t axis;               // Rate1 axis on the motor shaft, AXIS_X/Y/Z
+    uint8_t points;             // Rates per direction, 1..CALIBRATION_MAX_POINTS
+    uint16_t reserved;
+} CalibrationParams;
+
+void CalibrationLoadDefaults(CalibrationParams *params);
+int32_t CalibrationStart(void);
+void CalibrationAbort(void);
+void CalibrationUpdate(const SCHRawData *data);
+void CalibrationSend(void);
+CalibrationState CalibrationGetState(void);
+bool CalibrationIsBusy(void);
+#endif
@@ -0,0 +1,300 @@
+/* Capture.c
+ * Shock capture: raw full-rate samples around a trigger, sent as a burst.
+ *
+ * While armed every sample (Rate1, Acc1 and Acc3, raw) is written into a
+ * RAM ring of CAPTURE_RECORDS samples. A trigger (Acc3 or Rate1 magnitude
+ * over a threshold, the CAPTURE_TRIG pin or a command) fixes a window of
+ * preTrigger samples before the trigger sample and the rest of the ring
+ * after it. The complete window is frozen and sent from the housekeeping
+ * handler, only using link TX space above CAPTURE_SEND_MIN_FREE, so the
+ * decimated sample stream and the periodic reports keep running.
+ *
+ * The ring is written from the sample handler and read from the
+ * housekeeping event only while the state is CAPTURE_SENDING, when the
+ * sample handler leaves it alone.
+ */
+
+#include "Capture.h"
+#include "Link.h"
+#include "ConfigStore.h"
+#include "SampleRate.h"
+#include "Critical.h"
+#include "main.h"
+#include <string.h>
+
+#define CAPTURE_RATE1_BITS  (SCH_QUALITY_RATE1_X | SCH_QUALITY_RATE1_Y | SCH_QUALITY_RATE1_Z)
+#define CAPTURE_ACC1_BITS   (SCH_QUALITY_ACC1_X | SCH_QUALITY_ACC1_Y | SCH_QUALITY_ACC1_Z)
+#define CAPTURE_ACC3_BITS   (SCH_QUALITY_ACC3_X | SCH_QUALITY_ACC3_Y | SCH_QUALITY_ACC3_Z)
+
+static CaptureRecord ring[CAPTURE_RECORDS];
+static volatile CaptureState state = CAPTURE_OFF;
+static volatile bool pinTrigger = false;    // Set by the EXTI0 interrupt, taken by the next sample
+static volatile bool commandTrigger = false;
+
+// Sample handler state
+static uint16_t position = 0;               // Next ring slot
+static uint16_t filled = 0;                 // Samples recorded since arming, up to preTrigger
+static uint16_t remaining = 0;              // Post-trigger samples still to record
+static uint16_t windowStart = 0;            // Ring slot of the first window sample
+
+// Configuration, CaptureSetMode()
+static uint8_t triggers = 0;
+static uint16_t preTrigger = 0;
+static uint64_t accThreshold2 = 0;          // Acc3 magnitude squared, LSB^2
+static uint64_t rateThreshold2 = 0;         // Rate1 magnitude squared, LSB^2
+static bool repeat = false;
+
+// Frozen window, housekeeping event while sending
+static CaptureHeader header;
+static uint16_t sent = 0;
+static uint16_t windows = 0;
+
+/**
+ * Store a 20-bit sensor value as signed 24-bit little-endian
+ */
+static void CapturePack(uint8_t *out, int32_t value)
+{
+    out[0] = (uint8_t)value;
+    out[1] = (uint8_t)(value >> 8);
+    out[2] = (uint8_t)(value >> 16);
+}
+
+static uint64_t CaptureMagnitude2(int32_t x, int32_t y, int32_t z)
+{
+    return (uint64_t)((int64_t)x * x) + (uint64_t)((int64_t)y * y) + (uint64_t)((int64_t)z * z);
+}
+
+/**
+ * Trigger sources that fire on this sample, CAPTURE_TRIG_xxx
+ */
+static uint8_t CaptureCheck(const SCHRawData *data)
+{
+    uint8_t fired = 0;
+
+    if (pinTrigger) {
+        pinTrigger = false;
+        if (triggers & CAPTURE_TRIG_PIN)
+            fired |= CAPTURE_TRIG_PIN;
+    }
+    if (commandTrigger) {
+        commandTrigger = false;
+        fired |= CAPTURE_TRIG_COMMAND;
+    }
+
+    // A corrupted frame must not trigger
+    if ((triggers & CAPTURE_TRIG_ACC) && ((data->quality & CAPTURE_ACC3_BITS) == 0)) {
+        if (CaptureMagnitude2(data->acc3Raw[AXIS_X], data->acc3Raw[AXIS_Y], data->acc3Raw[AXIS_Z]) > accThreshold2)
+            fired |= CAPTURE_TRIG_ACC;
+    }
+    if ((triggers & CAPTURE_TRIG_RATE) && ((data->quality & CAPTURE_RATE1_BITS) == 0)) {
+        if (CaptureMagnitude2(SCHGetRate1Counts(data, AXIS_X), SCHGetRate1Counts(data, AXIS_Y),
+                              SCHGetRate1Counts(data, AXIS_Z)) > rateThreshold2)
+            fired |= CAPTURE_TRIG_RATE;
+    }
+
+    return fired;
+}
+
+/**
+ * Start filling the ring, callable from the event handlers and under CriticalEnter()
+ */
+static void CaptureArm(void)
+{
+    position = 0;
+    filled = 0;
+    remaining = 0;
+    pinTrigger = false;
+    commandTrigger = false;
+    state = CAPTURE_ARMING;
+}
+
+/**
+ * Record one sample and check the triggers. Called from the sample handler.
+ */
+void CaptureUpdate(const SCHRawData *data, uint32_t sampleCounter)
+{
+    CaptureState current = state;
+    CaptureRecord *record;
+    uint8_t fired;
+
+    if ((current == CAPTURE_OFF) || (current == CAPTURE_SENDING))
+        return;
+
+    record = &ring[position];
+    for (int axis = AXIS_X; axis <= AXIS_Z; axis++)
+    {
+        CapturePack(record->rate1[axis], data->rate1Raw[axis]);
+        CapturePack(record->acc1[axis], data->acc1Raw[axis]);
+        CapturePack(record->acc3[axis], data->acc3Raw[axis]);
+    }
+    record->flags = 0;
+    if (data->quality & CAPTURE_RATE1_BITS)
+        record->flags |= CAPTURE_BAD_RATE1;
+    if (data->quality & CAPTURE_ACC1_BITS)
+        record->flags |= CAPTURE_BAD_ACC1;
+    if (data->quality & CAPTURE_ACC3_BITS)
+        record->flags |= CAPTURE_BAD_ACC3;
+
+    if (current == CAPTURE_ARMING) {
+        // Triggers are ignored until the pre-trigger part is complete
+        if (filled < preTrigger) {
+            filled++;
+            pinTrigger = false;
+            commandTrigger = false;
+            position = (position + 1) % CAPTURE_RECORDS;
+            return;
+        }
+        current = CAPTURE_ARMED;
+        state = current;
+    }
+
+    if (current == CAPTURE_ARMED) {
+        fired = CaptureCheck(data);
+        if (fired != 0) {
+            windowStart = (uint16_t)((position + CAPTURE_RECORDS - preTrigger) % CAPTURE_RECORDS);
+            remaining = (uint16_t)(CAPTURE_RECORDS - preTrigger);
+            header.triggerSample = sampleCounter;
+            header.sampleRate = (uint16_t)SampleRateGet();
+            header.source = fired;
+            current = CAPTURE_TRIGGERED;
+            state = current;
+        }
+    }
+
+    position = (position + 1) % CAPTURE_RECORDS;
+
+    // Includes the trigger sample itself
+    if ((current == CAPTURE_TRIGGERED) && (--remaining == 0)) {
+        header.window = ++windows;
+        sent = 0;
+        state = CAPTURE_SENDING;
+    }
+}
+
+/**
+ * CAPTURE_TRIG pin edge, EXTI0 interrupt
+ */
+void CaptureTriggerIrq(void)
+{
+    if (state == CAPTURE_ARMED)
+        pinTrigger = true;
+}
+
+/**
+ * @brief Change the capture mode.
+ *
+ * @param mode - CAPTURE_MODE_xxx
+ * @param triggers - CAPTURE_TRIG_xxx, SINGLE and REPEAT only
+ * @param preTrigger - samples kept before the trigger sample, below CAPTURE_RECORDS
+ * @param accThreshold - Acc3 magnitude, mm/s2 (gravity included)
+ * @param rateThreshold - Rate1 magnitude, mdps
+ * @return SCH_OK, SCH_ERR_INVALID_PARAM, or SCH_ERR_OTHER for a trigger
+ *         while not armed
+ */
+int32_t CaptureSetMode(uint8_t mode, uint8_t triggersIn, uint16_t preTriggerIn, int32_t accThreshold, int32_t rateThreshold)
+{
+    uint32_t basepri;
+    int64_t accCounts, rateCounts;
+
+    switch (mode)
+    {
+        case CAPTURE_MODE_STATUS:
+            return SCH_OK;
+
+        case CAPTURE_MODE_OFF:
+            basepri = CriticalEnter();
+            state = CAPTURE_OFF;
+            CriticalExit(basepri);
+            SCHSetReadAcc3(SCH_ACC3_CAPTURE, false);
+            return SCH_OK;
+
+        case CAPTURE_MODE_TRIGGER:
+            if (state != CAPTURE_ARMED)
+                return SCH_ERR_OTHER;
+            commandTrigger = true;
+            return SCH_OK;
+
+        case CAPTURE_MODE_SINGLE:
+        case CAPTURE_MODE_REPEAT:
+            break;
+
+        default:
+            return SCH_ERR_INVALID_PARAM;
+    }
+
+    if ((triggersIn & ~CAPTURE_TRIG_ALL) || (preTriggerIn >= CAPTURE_RECORDS))
+        return SCH_ERR_INVALID_PARAM;
+    if (((triggersIn & CAPTURE_TRIG_ACC) && (accThreshold <= 0)) ||
+        ((triggersIn & CAPTURE_TRIG_RATE) && (rateThreshold <= 0)))
+        return SCH_ERR_INVALID_PARAM;
+
+    // Thresholds in raw counts at the configured nominal sensitivities
+    accCounts  = ((int64_t)accThreshold * appConfig.sensitivity.acc3) / 1000;
+    rateCounts = ((int64_t)rateThreshold * appConfig.sensitivity.rate1) / 1000;
+
+    basepri = CriticalEnter();
+    triggers = triggersIn;
+    preTrigger = preTriggerIn;
+    accThreshold2 = (uint64_t)(accCounts * accCounts);
+    rateThreshold2 = (uint64_t)(rateCounts * rateCounts);
+    repeat = (mode == CAPTURE_MODE_REPEAT);
+    CaptureArm();
+    CriticalExit(basepri);
+
+    SCHSetReadAcc3(SCH_ACC3_CAPTURE, true);
+    return SCH_OK;
+}
+
+void CaptureGetStatus(PktCaptureStatus *status)
+{
+    status->state = (uint8_t)state;
+    status->triggers = triggers;
+    status->capacity = CAPTURE_RECORDS;
+    status->preTrigger = preTrigger;
+    status->window = windows;
+    status->windowUs = (uint32_t)(((uint64_t)CAPTURE_RECORDS * 1000000U) / SampleRateGet());
+    status->sent = sent;
+    status->repeat = repeat;
+    status->reserved = 0;
+}
+
+/**
+ * Send the next part of a frozen window, at most one packet per call.
+ * Called from the housekeeping handler.
+ */
+void CaptureSend(void)
+{
+    PktCapture pkt;
+    uint16_t count;
+
+    if (state != CAPTURE_SENDING)
+        return;
+    if (LinkTxFree() < (CAPTURE_SEND_MIN_FREE + sizeof(pkt) + LINK_HEADER_SIZE + LINK_CRC_SIZE))
+        return;
+
+    count = CAPTURE_RECORDS - sent;
+    if (count > CAPTURE_RECORDS_PER_PACKET)
+        count = CAPTURE_RECORDS_PER_PACKET;
+
+    pkt.header = header;
+    pkt.header.index = sent;
+    pkt.header.records = CAPTURE_RECORDS;
+    pkt.header.preTrigger = preTrigger;
+    pkt.header.count = (uint8_t)count;
+    for (uint16_t i = 0; i < count; i++)
+        pkt.records[i] = ring[(windowStart + sent + i) % CAPTURE_RECORDS];
+
+    if (!LinkSend(PKT_CAPTURE, &pkt, (uint8_t)(sizeof(pkt.header) + count * sizeof(CaptureRecord))))
+        return;
+
+    sent += count;
+    if (sent < CAPTURE_RECORDS)
+        return;
+
+    if (repeat) {
+        CaptureArm();
+    } else {
+        state = CAPTURE_OFF;
+        SCHSetReadAcc3(SCH_ACC3_CAPTURE, false);
+    }
+}
@@ -0,0 +1,97 @@
+#ifndef _CAPTURE_H
+#define _CAPTURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "SCHSensor.h"
+
+#define CAPTURE_RECORDS             200     // Ring size in samples, 5600 bytes of RAM
+#define CAPTURE_RECORDS_PER_PACKET  8       // Records in one PKT_CAPTURE
+#define CAPTURE_SEND_MIN_FREE       512     // Link TX bytes left free for the sample stream
+
+/**
+ * Capture state (PktCaptureStatus.state)
+ */
+typedef enum {
+    CAPTURE_OFF = 0,
+    CAPTURE_ARMING,             // Filling the pre-trigger part of the ring
+    CAPTURE_ARMED,              // Waiting for a trigger
+    CAPTURE_TRIGGERED,          // Recording the post-trigger part
+    CAPTURE_SENDING             // Window frozen, sent as a burst
+} CaptureState;
+
+/**
+ * CMD_CAPTURE modes
+ */
+#define CAPTURE_MODE_OFF            0   // Stop, Acc3 reads off
+#define CAPTURE_MODE_SINGLE         1   // Arm, capture one window
+#define CAPTURE_MODE_REPEAT         2   // Arm, re-arm after every window has been sent
+#define CAPTURE_MODE_TRIGGER        3   // Trigger now (armed only)
+#define CAPTURE_MODE_STATUS         4   // Only report PKT_CAPTURE_STATUS
+
+/**
+ * Trigger sources (CmdCapture.triggers, CaptureHeader.source)
+ */
+#define CAPTURE_TRIG_ACC            0x01    // Acc3 magnitude over accThreshold, gravity included
+#define CAPTURE_TRIG_RATE           0x02    // Rate1 magnitude over rateThreshold
+#define CAPTURE_TRIG_PIN            0x04    // CAPTURE_TRIG falling edge (PA0)
+#define CAPTURE_TRIG_COMMAND        0x08    // CAPTURE_MODE_TRIGGER, always enabled
+#define CAPTURE_TRIG_ALL            0x07
+
+/**
+ * Record quality flags, set = the values of the sensor are not valid
+ */
+#define CAPTURE_BAD_RATE1           0x01
+#define CAPTURE_BAD_ACC1            0x02
+#define CAPTURE_BAD_ACC3            0x04
+
+/**
+ * One raw sample, 20-bit values as signed 24-bit little-endian
+ */
+typedef struct {
+    uint8_t rate1[3][3];
+    uint8_t acc1[3][3];
+    uint8_t acc3[3][3];
+    uint8_t flags;              // CAPTURE_BAD_xxx
+} CaptureRecord;
+
+typedef struct {
+    uint32_t triggerSample;     // Sample counter of the trigger sample
+    uint16_t sampleRate;        // Hz at the trigger
+    uint16_t index;             // Window index of the first record in this packet
+    uint16_t records;           // Records in the window
+    uint16_t preTrigger;        // Records before the trigger sample
+    uint8_t  count;             // Records in this packet
+    uint8_t  source;            // CAPTURE_TRIG_xxx that fired
+    uint16_t window;            // Window sequence number since boot
+} CaptureHeader;
+
+/**
+ * PKT_CAPTURE payload, sized to the records it carries
+ */
+typedef struct {
+    CaptureHeader header;
+    CaptureRecord records[CAPTURE_RECORDS_PER_PACKET];
+} PktCapture;
+
+/**
+ * PKT_CAPTURE_STATUS payload
+ */
+typedef struct {
+    uint8_t  state;             // CaptureState
+    uint8_t  triggers;          // Enabled CAPTURE_TRIG_xxx
+    uint16_t capacity;          // Records in a window, CAPTURE_RECORDS
+    uint16_t preTrigger;        // Records before the trigger sample
+    uint16_t window;            // Windows captured since boot
+    uint32_t windowUs;          // Window length at the current sample rate
+    uint16_t sent;              // Records of the frozen window sent
+    uint8_t  repeat;            // Re-arm after sending
+    uint8_t  reserved;
+} PktCaptureStatus;
+
+void CaptureUpdate(const SCHRawData *data, uint32_t sampleCounter);
+void CaptureTriggerIrq(void);
+int32_t CaptureSetMode(uint8_t mode, uint8_t triggers, uint16_t preTrigger, int32_t accThreshold, int32_t rateThreshold);
+void CaptureGetStatus(PktCaptureStatus *status);
+void CaptureSend(void);
+#endif
@@ -0,0 +1,319 @@
+/* Command.c
+ * Host command dispatcher for frames received by the link.
+ */
+
+#include "Command.h"
+#include "Link.h"
+#include "ConfigStore.h"
+#include "Stepper.h"
+#include "Motion.h"
+#include "Controller.h"
+#include "Homing.h"
+#include "Calibration.h"
+#include "Profiler.h"
+#include "Trace.h"
+#include "SampleRate.h"
+#include "Capture.h"
+#include "ZeroMotion.h"
+#include "Allan.h"
+#include "main.h"
+#include <string.h>
+
+/**
+ * Send PKT_ACK for a command
+ */
+void CommandAck(uint8_t command, int32_t status, uint16_t detail)
+{
+    PktAck ack;
+
+    ack.command = command;
+    ack.status  = (int8_t)status;
+    ack.detail  = detail;
+    LinkSend(PKT_ACK, &ack, sizeof(ack));
+}
+
+/**
+ * @brief Execute one host command.
+ *
+ * @param command - CMD_xxx
+ * @param payload - command payload
+ * @param size - payload size in bytes
+ */
+void CommandProcess(uint8_t command, const uint8_t *payload, uint8_t size)
+{
+    TraceWrite(TRACE_COMMAND, command);
+
+    switch (command)
+    {
+        case CMD_GET_CONFIG:
+        {
+            PktConfig pkt;
+
+            pkt.version  = CONFIG_VERSION;
+            pkt.size     = sizeof(AppConfig);
+            pkt.sequence = ConfigGetSequence();
+            pkt.config   = appConfig;
+            LinkSend(PKT_CONFIG, &pkt, sizeof(pkt));
+            break;
+        }
+
+        case CMD_SET_PARAM:
+        {
+            CmdSetParam cmd;
+            int32_t status;
+
+            if (size != sizeof(cmd)) {
+                CommandAck(command, SCH_ERR_INVALID_PARAM, 0);
+                break;
+            }
+            memcpy(&cmd, payload, sizeof(cmd));
+            status = ConfigSetParam(cmd.param, cmd.value);
+            if (status == SCH_OK) {
+                // Stored either way, the ACK reports a loop gain that rounds to zero
+                status = ControllerConfigure();
+                ZeroMotionConfigure();
+            }
+            CommandAck(command, status, cmd.param);
+            break;
+        }
+
+        case CMD_SET_CALIBRATION:
+            if (size != sizeof(SCHCalibration)) {
+                CommandAck(command, SCH_ERR_INVALID_PARAM, 0);
+                break;
+            }
+            memcpy(&appConfig.calibration, payload, sizeof(SCHCalibration));
+            SCHSetCalibration(&appConfig.calibration);
+            ControllerConfigure();
+            ZeroMotionReseed();
+            CommandAck(command, SCH_OK, 0);
+            break;
+
+        case CMD_SAVE_CONFIG:
+            // Stalls acquisition for the flash erase and program, the
+            // samples missed meanwhile go to PktHealth missedSamples
+            CommandAck(command, ConfigSave(), (uint16_t)ConfigGetSequence());
+            break;
+
+        case CMD_LOAD_DEFAULTS:
+            ConfigLoadDefaults(&appConfig);
+            SCHSetCalibration(&appConfig.calibration);
+            ControllerConfigure();
+            ZeroMotionConfigure();
+            CommandAck(command, SCH_OK, 0);
+            break;
+
+        case CMD_SYSTEM_RESET:
+            CommandAck(command, SCH_OK, 0);
+            LinkTxFlush(LINK_TX_FLUSH_TIMEOUT_MS);   // Let the ACK leave the UART
+            NVIC_SystemReset();
+            break;
+
+        case CMD_MOTOR_ENABLE:
+            if (size != 1) {
+                CommandAck(command, SCH_ERR_INVALID_PARAM, 0);
+                break;
+            }
+            if ((payload[0] != 0) && StepperIsFaulted()) {
+                CommandAck(command, SCH_ERR_OTHER, 0);
+                break;
+            }
+            StepperEnable(payload[0] != 0);
+            CommandAck(command, SCH_OK, 0);
+            break;
+
+        case CMD_MOTOR_REARM:
+            CommandAck(command, StepperRearm(), 0);
+            break;
+
+        case CMD_MOTOR_SET_RATE:
+        {
+            int32_t rate;
+
+            if (size != sizeof(rate)) {
+                CommandAck(command, SCH_ERR_INVALID_PARAM, 0);
+                break;
+            }
+            memcpy(&rate, payload, sizeof(rate));
+            if ((rate != 0) && (MotionIsBusy() || ControllerIsEnabled() || HomingIsBusy() || CalibrationIsBusy())) {
+                CommandAck(command, SCH_ERR_OTHER, 0);
+                break;
+            }
+            CommandAck(command, StepperSetRate(rate), 0);
+            break;
+        }
+
+        case CMD_MOTION_MOVE:
+        {
+            int32_t steps;
+
+            if (size != sizeof(steps)) {
+                CommandAck(command, SCH_ERR_INVALID_PARAM, 0);
+                break;
+            }
+            memcpy(&steps, payload, sizeof(steps));
+            if (ControllerIsEnabled() || HomingIsBusy() || CalibrationIsBusy()) {
+                CommandAck(command, SCH_ERR_OTHER, 0);
+                break;
+            }
+            CommandAck(command, MotionMove(steps), 0);
+            break;
+        }
+
+        case CMD_MOTION_QUEUE:
+        {
+            CmdMotionQueue cmd;
+            MotionStats stats;
+            int32_t status;
+
+            if (size != sizeof(cmd)) {
+                CommandAck(command, SCH_ERR_INVALID_PARAM, 0);
+                break;
+            }
+            memcpy(&cmd, payload, sizeof(cmd));
+            if (ControllerIsEnabled() || HomingIsBusy() || CalibrationIsBusy())
+                status = SCH_ERR_OTHER;
+            else
+                status = MotionQueue(cmd.steps, cmd.velocity);
+            MotionGetStats(&stats);
+            CommandAck(command, status, stats.free);
+            break;
+        }
+
+        case CMD_MOTION_STATUS:
+        {
+            MotionStats stats;
+
+            MotionGetStats(&stats);
+            LinkSend(PKT_MOTION_STATUS, &stats, sizeof(stats));
+            break;
+        }
+
+        case CMD_PROFILE:
+            if ((size != 1) || (payload[0] > 1)) {
+                CommandAck(command, SCH_ERR_INVALID_PARAM, 0);
+                break;
+            }
+            if (payload[0] == 1) {
+                ProfilerReset();
+                CommandAck(command, PROFILER_ENABLED ? SCH_OK : SCH_ERR_OTHER, 0);
+            }
+            else if (ProfilerSend() != SCH_OK) {
+                CommandAck(command, SCH_ERR_OTHER, 0);
+            }
+            break;
+
+        case CMD_TRACE:
+        {
+            CmdTrace cmd;
+
+            if (size != sizeof(cmd)) {
+                CommandAck(command, SCH_ERR_INVALID_PARAM, 0);
+                break;
+            }
+            memcpy(&cmd, payload, sizeof(cmd));
+            CommandAck(command, TraceSetMode(cmd.mode, cmd.mask), 0);
+            break;
+        }
+
+        case CMD_SAMPLE_RATE:
+        {
+            CmdSampleRate cmd;
+            SampleRatePlan plan;
+
+            if (size != sizeof(cmd)) {
+                CommandAck(command, SCH_ERR_INVALID_PARAM, 0);
+                break;
+            }
+            memcpy(&cmd, payload, sizeof(cmd));
+            if (cmd.rate != 0) {
+                int32_t status = SampleRateSet(cmd.rate, cmd.clamp != 0);
+
+                SampleRateGetPlan(&plan);
+                CommandAck(command, status, plan.reason);
+            }
+            SampleRateGetPlan(&plan);
+            LinkSend(PKT_SAMPLE_RATE, &plan, sizeof(plan));
+            break;
+        }
+
+        case CMD_CAPTURE:
+        {
+            CmdCapture cmd;
+            PktCaptureStatus status;
+
+            if (size != sizeof(cmd)) {
+                CommandAck(command, SCH_ERR_INVALID_PARAM, 0);
+                break;
+            }
+            memcpy(&cmd, payload, sizeof(cmd));
+            if (cmd.mode != CAPTURE_MODE_STATUS)
+                CommandAck(command, CaptureSetMode(cmd.mode, cmd.triggers, cmd.preTrigger, cmd.accThreshold, cmd.rateThreshold), CAPTURE_RECORDS);
+            CaptureGetStatus(&status);
+            LinkSend(PKT_CAPTURE_STATUS, &status, sizeof(status));
+            break;
+        }
+
+        case CMD_ALLAN:
+        {
+            CmdAllan cmd;
+
+            if (size != sizeof(cmd)) {
+                CommandAck(command, SCH_ERR_INVALID_PARAM, 0);
+                break;
+            }
+            memcpy(&cmd, payload, sizeof(cmd));
+            CommandAck(command, AllanCommand(cmd.mode, cmd.baseShift), ALLAN_LEVELS);
+            break;
+        }
+
+        case CMD_MOTION_STOP:
+            MotionStop();
+            CommandAck(command, SCH_OK, 0);
+            break;
+
+        case CMD_CONTROLLER_ENABLE:
+            if (size != 1) {
+                CommandAck(command, SCH_ERR_INVALID_PARAM, 0);
+                break;
+            }
+            if ((payload[0] != 0) && (HomingIsBusy() || CalibrationIsBusy())) {
+                CommandAck(command, SCH_ERR_OTHER, 0);
+                break;
+            }
+            CommandAck(command, ControllerEnable(payload[0] != 0), 0);
+            break;
+
+        case CMD_HOME:
+            if (size != 1) {
+                CommandAck(command, SCH_ERR_INVALID_PARAM, 0);
+                break;
+            }
+            if (payload[0] != 0) {
+                CommandAck(command, CalibrationIsBusy() ? SCH_ERR_OTHER : HomingStart(), 0);
+            }
+            else {
+                HomingAbort();
+                CommandAck(command, SCH_OK, 0);
+            }
+            break;
+
+        case CMD_CALIBRATE:
+            if (size != 1) {
+                CommandAck(command, SCH_ERR_INVALID_PARAM, 0);
+                break;
+            }
+            if (payload[0] != 0) {
+                CommandAck(command, CalibrationStart(), 0);
+            }
+            else {
+                CalibrationAbort();
+                CommandAck(command, SCH_OK, 0);
+            }
+            break;
+
+        default:
+            CommandAck(command, SCH_ERR_INVALID_PARAM, 0);
+            break;
+    }
+}
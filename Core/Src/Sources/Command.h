@@ -0,0 +1,8 @@
+#ifndef _COMMAND_H
+#define _COMMAND_H
+
+#include <stdint.h>
+
+void CommandProcess(uint8_t command, const uint8_t *payload, uint8_t size);
+void CommandAck(uint8_t command, int32_t status, uint16_t detail);
+#endif
@@ -0,0 +1,450 @@
+/* ConfigStore.c
+ * Versioned, CRC protected configuration store in the last two flash pages.
+ *
+ * Each save writes a complete record to the page that does NOT hold the
+ * current record, so an interrupted erase/program never destroys the last
+ * good configuration. On load the valid record with the highest sequence
+ * number wins.
+ */
+
+#include "ConfigStore.h"
+#include "Protocol.h"
+#include "Crc.h"
+#include "Stepper.h"
+#include "SampleRate.h"
+#include "main.h"
+#include <string.h>
+#include <stddef.h>
+
+typedef struct {
+    uint32_t  magic;
+    uint16_t  version;
+    uint16_t  length;
+    uint32_t  sequence;
+    AppConfig config;
+    uint16_t  crc;
+    uint16_t  reserved;
+} ConfigRecord;
+
+AppConfig appConfig;
+
+static uint32_t activePage = 0;     // Page holding the current record, 0 = none
+static uint32_t activeSequence = 0;
+
+/**
+ * Factory defaults, same values the firmware used to hard-code
+ */
+void ConfigLoadDefaults(AppConfig *config)
+{
+    memset(config, 0, sizeof(AppConfig));
+
+    config->filter.rate  = FILTER_RATE;
+    config->filter.acc   = FILTER_ACC12;
+    config->filter.acc3  = FILTER_ACC3;
+
+    config->sensitivity.rate1 = SENSITIVITY_RATE1;
+    config->sensitivity.rate2 = SENSITIVITY_RATE2;
+    config->sensitivity.acc1  = SENSITIVITY_ACC1;
+    config->sensitivity.acc2  = SENSITIVITY_ACC2;
+    config->sensitivity.acc3  = SENSITIVITY_ACC3;
+
+    config->decimation.rate2 = DECIMATION_RATE;
+    config->decimation.acc2  = DECIMATION_ACC;
+
+    config->enableDry     = false;
+    config->outputDivider = DEFAULT_OUTPUT_DIVIDER;
+    config->baudRate      = DEFAULT_BAUD_RATE;
+    config->streams       = STREAM_SAMPLES;
+    config->sampleRate    = SAMPLE_RATE_DEFAULT_HZ;
+
+    MotionLoadDefaults(&config->motion);
+    ControllerLoadDefaults(&config->controller);
+    HomingLoadDefaults(&config->homing);
+    CalibrationLoadDefaults(&config->calibrationTable);
+    StatsLoadDefaults(&config->stats);
+    FftLoadDefaults(&config->fft);
+    ZeroMotionLoadDefaults(&config->zeroMotion);
+    TiltLoadDefaults(&config->tilt);
+}
+
+/**
+ * Check record in flash, returns true when magic, version, length and CRC match
+ */
+static bool ConfigRecordValid(const ConfigRecord *record)
+{
+    if (record->magic != CONFIG_MAGIC)
+        return false;
+    if (record->version != CONFIG_VERSION)
+        return false;
+    if (record->length != sizeof(AppConfig))
+        return false;
+    if (record->crc != Crc16(record, offsetof(ConfigRecord, crc)))
+        return false;
+
+    return true;
+}
+
+/**
+ * Load configuration from flash into appConfig. Falls back to defaults
+ * when neither page holds a valid record.
+ */
+int32_t ConfigLoad(void)
+{
+    const ConfigRecord *recordA = (const ConfigRecord *)CONFIG_PAGE_A;
+    const ConfigRecord *recordB = (const ConfigRecord *)CONFIG_PAGE_B;
+    const ConfigRecord *record = NULL;
+    bool validA = ConfigRecordValid(recordA);
+    bool validB = ConfigRecordValid(recordB);
+
+    if (validA && validB)
+        record = ((int32_t)(recordB->sequence - recordA->sequence) > 0) ? recordB : recordA;
+    else if (validA)
+        record = recordA;
+    else if (validB)
+        record = recordB;
+
+    if (record == NULL) {
+        ConfigLoadDefaults(&appConfig);
+        activePage = 0;
+        activeSequence = 0;
+        return SCH_ERR_OTHER;
+    }
+
+    memcpy(&appConfig, &record->config, sizeof(AppConfig));
+    activePage = (uint32_t)record;
+    activeSequence = record->sequence;
+
+    return SCH_OK;
+}
+
+/**
+ * Write appConfig to the inactive page. Flash erase stalls the CPU for
+ * ~20 ms, so this is only called on host request.
+ */
+int32_t ConfigSave(void)
+{
+    static ConfigRecord record;
+    FLASH_EraseInitTypeDef erase;
+    uint32_t pageError = 0;
+    uint32_t targetPage = (activePage == CONFIG_PAGE_A) ? CONFIG_PAGE_B : CONFIG_PAGE_A;
+    const uint16_t *source = (const uint16_t *)&record;
+    int32_t ret = SCH_OK;
+
+    memset(&record, 0xFF, sizeof(record));
+    record.magic    = CONFIG_MAGIC;
+    record.version  = CONFIG_VERSION;
+    record.length   = sizeof(AppConfig);
+    record.sequence = activeSequence + 1;
+    memcpy(&record.config, &appConfig, sizeof(AppConfig));
+    record.crc      = Crc16(&record, offsetof(ConfigRecord, crc));
+
+    erase.TypeErase   = FLASH_TYPEERASE_PAGES;
+    erase.Banks       = FLASH_BANK_1;
+    erase.PageAddress = targetPage;
+    erase.NbPages     = 1;
+
+    HAL_FLASH_Unlock();
+
+    if (HAL_FLASHEx_Erase(&erase, &pageError) != HAL_OK)
+        ret = SCH_ERR_OTHER;
+
+    for (uint32_t offset = 0; (ret == SCH_OK) && (offset < sizeof(record)); offset += 2)
+    {
+        if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, targetPage + offset, source[offset / 2]) != HAL_OK)
+            ret = SCH_ERR_OTHER;
+    }
+
+    HAL_FLASH_Lock();
+
+    // Record becomes active only when it reads back valid.
+    if ((ret == SCH_OK) && ConfigRecordValid((const ConfigRecord *)targetPage)) {
+        activePage = targetPage;
+        activeSequence = record.sequence;
+    }
+    else {
+        ret = SCH_ERR_OTHER;
+    }
+
+    return ret;
+}
+
+/**
+ * Current record sequence number, 0 when running on defaults
+ */
+uint32_t ConfigGetSequence(void)
+{
+    return activeSequence;
+}
+
+/**
+ * Validate and set one parameter in appConfig (RAM only, see ConfigSave)
+ */
+int32_t ConfigSetParam(uint8_t param, int32_t value)
+{
+    switch (param)
+    {
+        case PARAM_FILTER_RATE:
+        case PARAM_FILTER_ACC12:
+        case PARAM_FILTER_ACC3:
+            if ((value < 0) || !SCHIsValidFilterFreq((uint32_t)value))
+                return SCH_ERR_INVALID_PARAM;
+            if (param == PARAM_FILTER_RATE)
+                appConfig.filter.rate = (uint16_t)value;
+            else if (param == PARAM_FILTER_ACC12)
+                appConfig.filter.acc = (uint16_t)value;
+            else
+                appConfig.filter.acc3 = (uint16_t)value;
+            break;
+
+        case PARAM_SENS_RATE1:
+        case PARAM_SENS_RATE2:
+            if ((value < 0) || !SCHIsValidRateSens((uint32_t)value))
+                return SCH_ERR_INVALID_PARAM;
+            if (param == PARAM_SENS_RATE1)
+                appConfig.sensitivity.rate1 = (uint16_t)value;
+            else
+                appConfig.sensitivity.rate2 = (uint16_t)value;
+            break;
+
+        case PARAM_SENS_ACC1:
+        case PARAM_SENS_ACC2:
+        case PARAM_SENS_ACC3:
+            if ((value < 0) || !SCHIsValidAccSens((uint32_t)value))
+                return SCH_ERR_INVALID_PARAM;
+            if (param == PARAM_SENS_ACC1)
+                appConfig.sensitivity.acc1 = (uint16_t)value;
+            else if (param == PARAM_SENS_ACC2)
+                appConfig.sensitivity.acc2 = (uint16_t)value;
+            else
+                appConfig.sensitivity.acc3 = (uint16_t)value;
+            break;
+
+        case PARAM_DEC_RATE2:
+        case PARAM_DEC_ACC2:
+            if ((value < 0) || !SCHIsValidDecimation((uint32_t)value))
+                return SCH_ERR_INVALID_PARAM;
+            if (param == PARAM_DEC_RATE2)
+                appConfig.decimation.rate2 = (uint16_t)value;
+            else
+                appConfig.decimation.acc2 = (uint16_t)value;
+            break;
+
+        case PARAM_ENABLE_DRY:
+            appConfig.enableDry = (value != 0);
+            break;
+
+        case PARAM_BAUD_RATE:
+            if ((value < 9600) || (value > 2000000))
+                return SCH_ERR_INVALID_PARAM;
+            appConfig.baudRate = (uint32_t)value;
+            break;
+
+        case PARAM_OUTPUT_DIVIDER:
+            if ((value < 1) || (value > 10000))
+                return SCH_ERR_INVALID_PARAM;
+            appConfig.outputDivider = (uint16_t)value;
+            break;
+
+        case PARAM_STREAMS:
+            appConfig.streams = (uint32_t)value;
+            break;
+
+        case PARAM_MOTION_PROFILE:
+            if ((value != MOTION_PROFILE_TRAPEZOID) && (value != MOTION_PROFILE_SCURVE))
+                return SCH_ERR_INVALID_PARAM;
+            appConfig.motion.profile = (uint8_t)value;
+            break;
+
+        case PARAM_MOTION_MAX_VELOCITY:
+        case PARAM_MOTION_START_VELOCITY:
+            if ((value < 1) || (value > STEPPER_MAX_RATE))
+                return SCH_ERR_INVALID_PARAM;
+            if (param == PARAM_MOTION_MAX_VELOCITY)
+                appConfig.motion.maxVelocity = value;
+            else
+                appConfig.motion.startVelocity = value;
+            break;
+
+        case PARAM_MOTION_ACCELERATION:
+            if ((value < 1) || (value > 10000000))
+                return SCH_ERR_INVALID_PARAM;
+            appConfig.motion.acceleration = value;
+            break;
+
+        case PARAM_STEPPER_DMA:
+            appConfig.stepperDma = (value != 0);
+            break;
+
+        case PARAM_MOTION_JERK:
+            if (value < 1)
+                return SCH_ERR_INVALID_PARAM;
+            appConfig.motion.jerk = value;
+            break;
+
+        case PARAM_HOME_DIRECTION:
+            if ((value != -1) && (value != 1))
+                return SCH_ERR_INVALID_PARAM;
+            appConfig.homing.direction = (int8_t)value;
+            break;
+
+        case PARAM_HOME_FAST_VELOCITY:
+        case PARAM_HOME_SLOW_VELOCITY:
+            if ((value < 1) || (value > STEPPER_MAX_RATE))
+                return SCH_ERR_INVALID_PARAM;
+            if (param == PARAM_HOME_FAST_VELOCITY)
+                appConfig.homing.fastVelocity = value;
+            else
+                appConfig.homing.slowVelocity = value;
+            break;
+
+        case PARAM_HOME_BACKOFF:
+        case PARAM_HOME_TRAVEL:
+            if (value < 1)
+                return SCH_ERR_INVALID_PARAM;
+            if (param == PARAM_HOME_BACKOFF)
+                appConfig.homing.backoff = value;
+            else
+                appConfig.homing.travel = value;
+            break;
+
+        case PARAM_HOME_OFFSET:
+            appConfig.homing.offset = value;
+            break;
+
+        case PARAM_CTRL_KP:
+            appConfig.controller.kp = value;
+            break;
+
+        case PARAM_CTRL_KI:
+            appConfig.controller.ki = value;
+            break;
+
+        case PARAM_CTRL_KD:
+            appConfig.controller.kd = value;
+            break;
+
+        case PARAM_CTRL_KFF:
+            appConfig.controller.kff = value;
+            break;
+
+        case PARAM_CTRL_SETPOINT:
+            if ((value < -1000000) || (value > 1000000))
+                return SCH_ERR_INVALID_PARAM;
+            appConfig.controller.setpoint = value;
+            break;
+
+        case PARAM_CTRL_AXIS:
+            if ((value < AXIS_X) || (value > AXIS_Z))
+                return SCH_ERR_INVALID_PARAM;
+            appConfig.controller.axis = (uint8_t)value;
+            break;
+
+        case PARAM_CTRL_DIVIDER:
+            if ((value < 1) || (value > 255))
+                return SCH_ERR_INVALID_PARAM;
+            appConfig.controller.divider = (uint8_t)value;
+            break;
+
+        case PARAM_CAL_STEPS_PER_REV:
+        case PARAM_CAL_MAX_RATE:
+        case PARAM_CAL_WINDOW_STEPS:
+            if (value < 1)
+                return SCH_ERR_INVALID_PARAM;
+            if (param == PARAM_CAL_STEPS_PER_REV)
+                appConfig.calibrationTable.stepsPerRev = value;
+            else if (param == PARAM_CAL_MAX_RATE)
+                appConfig.calibrationTable.maxRate = value;
+            else
+                appConfig.calibrationTable.windowSteps = value;
+            break;
+
+        case PARAM_CAL_POINTS:
+            if ((value < 1) || (value > CALIBRATION_MAX_POINTS))
+                return SCH_ERR_INVALID_PARAM;
+            appConfig.calibrationTable.points = (uint8_t)value;
+            break;
+
+        case PARAM_CAL_AXIS:
+            if ((value < AXIS_X) || (value > AXIS_Z))
+                return SCH_ERR_INVALID_PARAM;
+            appConfig.calibrationTable.axis = (uint8_t)value;
+            break;
+
+        case PARAM_STATS_SAMPLES:
+            if ((value < 0) || ((uint32_t)value > STATS_MAX_SAMPLES))
+                return SCH_ERR_INVALID_PARAM;
+            appConfig.stats.windowSamples = (uint32_t)value;
+            break;
+
+        case PARAM_STATS_PERIOD_MS:
+            if ((value < 0) || (value > 3600000))
+                return SCH_ERR_INVALID_PARAM;
+            appConfig.stats.windowMs = (uint32_t)value;
+            break;
+
+        case PARAM_FFT_AXIS:
+            if ((value < AXIS_X) || (value > AXIS_Z))
+                return SCH_ERR_INVALID_PARAM;
+            appConfig.fft.axis = (uint8_t)value;
+            break;
+
+        case PARAM_FFT_AVERAGES:
+            if ((value < 1) || (value > FFT_MAX_AVERAGES))
+                return SCH_ERR_INVALID_PARAM;
+            appConfig.fft.averages = (uint8_t)value;
+            break;
+
+        case PARAM_ZMOTION_MODE:
+            if ((value < ZERO_MOTION_OFF) || (value > ZERO_MOTION_TRACK))
+                return SCH_ERR_INVALID_PARAM;
+            appConfig.zeroMotion.mode = (uint8_t)value;
+            break;
+
+        case PARAM_ZMOTION_WINDOW:
+            if ((value < 16) || (value > 4096))
+                return SCH_ERR_INVALID_PARAM;
+            appConfig.zeroMotion.windowSamples = (uint16_t)value;
+            break;
+
+        case PARAM_ZMOTION_STILL_WINDOWS:
+            if ((value < 1) || (value > 255))
+                return SCH_ERR_INVALID_PARAM;
+            appConfig.zeroMotion.stillWindows = (uint8_t)value;
+            break;
+
+        case PARAM_ZMOTION_BIAS_SHIFT:
+            if ((value < 0) || (value > 15))
+                return SCH_ERR_INVALID_PARAM;
+            appConfig.zeroMotion.biasShift = (uint8_t)value;
+            break;
+
+        case PARAM_ZMOTION_RATE_NOISE:
+            if (value <= 0)
+                return SCH_ERR_INVALID_PARAM;
+            appConfig.zeroMotion.rateNoise = (int32_t)value;
+            break;
+
+        case PARAM_ZMOTION_ACC_NOISE:
+            if (value <= 0)
+                return SCH_ERR_INVALID_PARAM;
+            appConfig.zeroMotion.accNoise = (int32_t)value;
+            break;
+
+        case PARAM_TILT_SOURCE:
+            if ((value != TILT_SOURCE_ACC1) && (value != TILT_SOURCE_ACC3))
+                return SCH_ERR_INVALID_PARAM;
+            appConfig.tilt.source = (uint8_t)value;
+            break;
+
+        case PARAM_TILT_PERIOD_MS:
+            if ((value < TILT_MIN_PERIOD_MS) || (value > TILT_MAX_PERIOD_MS))
+                return SCH_ERR_INVALID_PARAM;
+            appConfig.tilt.periodMs = (uint16_t)value;
+            break;
+
+        default:
+            return SCH_ERR_INVALID_PARAM;
+    }
+
+    return SCH_OK;
+}
@@ -0,0 +1,64 @@
+#ifndef _CONFIGSTORE_H
+#define _CONFIGSTORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "SCHsensor.h"
+#include "Motion.h"
+#include "Controller.h"
+#include "Homing.h"
+#include "Calibration.h"
+#include "Stats.h"
+#include "Fft.h"
+#include "ZeroMotion.h"
+#include "Tilt.h"
+
+/**
+ * Flash layout. The store uses the last two 1 KB pages of the 64 KB device
+ * as A/B pages. The linker script keeps them out of FLASH (62 KB) and
+ * fails the link when the image would reach CONFIG_PAGE_A.
+ */
+#define CONFIG_PAGE_A               0x0800F800UL
+#define CONFIG_PAGE_B               0x0800FC00UL
+#define CONFIG_MAGIC                0x53434846UL    // "SCHF"
+#define CONFIG_VERSION              11              // Bump when AppConfig layout changes
+
+/**
+ * Default link settings
+ */
+#define DEFAULT_BAUD_RATE           460800
+#define DEFAULT_OUTPUT_DIVIDER      2               // 1 kHz acquisition, 500 Hz sample stream
+
+/**
+ * Persistent application configuration. Loaded into RAM once at boot,
+ * the sample path only ever reads appConfig.
+ */
+typedef struct {
+    SCHFilter      filter;
+    SCHSensitivity sensitivity;
+    SCHDecimation  decimation;
+    uint8_t        enableDry;
+    uint8_t        stepperDma;      // Step out planned moves through DMA
+    uint16_t       outputDivider;   // Send every Nth acquired sample
+    uint32_t       baudRate;
+    uint32_t       streams;         // STREAM_xxx bits
+    uint32_t       sampleRate;      // Acquisition rate, Hz, set with CMD_SAMPLE_RATE
+    SCHCalibration calibration;
+    MotionParams   motion;
+    ControllerParams controller;
+    HomingParams   homing;
+    CalibrationParams calibrationTable;   // Stepper rate table for CMD_CALIBRATE
+    StatsParams    stats;           // Statistics window (STREAM_STATS)
+    FftParams      fft;             // Vibration spectrum (STREAM_SPECTRUM)
+    ZeroMotionParams zeroMotion;    // Stationarity detector and Rate1 bias tracking
+    TiltParams     tilt;            // Inclination output (STREAM_TILT)
+} AppConfig;
+
+extern AppConfig appConfig;
+
+void    ConfigLoadDefaults(AppConfig *config);
+int32_t ConfigLoad(void);
+int32_t ConfigSave(void);
+int32_t ConfigSetParam(uint8_t param, int32_t value);
+uint32_t ConfigGetSequence(void);
+#endif
@@ -0,0 +1,216 @@
+/* Controller.c
+ * On-device rate loop: Rate1 axis in, stepper velocity out.
+ *
+ * Runs from the acquisition path on every divider-th sample. Gains are
+ * converted once to Q16 per raw gyro count and per loop period in
+ * ControllerConfigure(), the loop itself is integer only:
+ *
+ *   command = kff * setpoint + kp * e + ki * sum(e) + kd * (e - e_prev)
+ *
+ * The error is integrated in raw counts and multiplied by a Q32 ki per
+ * count and loop: at ~1/1600 dps per count and 1 ms loops ki shrinks by
+ * ~6e-7, which Q16 would round to zero for any practical gain.
+ *
+ * The command is limited to the motion velocity and acceleration settings;
+ * the integral is frozen while the command is limited (anti-windup), which
+ * also bounds sum(e) * ki to about the velocity limit.
+ */
+
+#include "Controller.h"
+#include "Stepper.h"
+#include "ConfigStore.h"
+#include "SampleRate.h"
+
+#define CONTROLLER_KI_EXTRA_SHIFT   16      // kiCounts is Q(CONTROLLER_GAIN_SHIFT + 16)
+
+static bool enabled = false;
+static uint8_t divideCounter = 0;
+static bool hasPrevious = false;
+static int32_t previousError = 0;       // Raw counts
+static int64_t errorSum = 0;            // Integrated error, counts * loops
+static int64_t integral = 0;            // Q16 steps/s
+static int32_t command = 0;             // steps/s
+static bool saturated = false;
+
+// Prepared by ControllerConfigure()
+static uint8_t axis;
+static uint8_t divider;
+static int32_t setpointCounts;
+static int64_t feedForward;             // Q16 steps/s
+static int32_t kpCounts;                // Q16 steps/s per count
+static int64_t kiCounts;                // Q32 steps/s per count and loop
+static int32_t kdCounts;                // Q16 steps/s per count change per loop
+static int32_t maxCommand;              // steps/s
+static int32_t maxDelta;                // steps/s per loop
+static float errorScale;                // mdps per count
+static bool gainsValid = true;          // No nonzero gain rounded to zero
+
+void ControllerLoadDefaults(ControllerParams *params)
+{
+    params->kp       = 0;
+    params->ki       = 0;
+    params->kd       = 0;
+    params->kff      = 0;
+    params->setpoint = 0;
+    params->axis     = CONTROLLER_DEFAULT_AXIS;
+    params->divider  = CONTROLLER_DEFAULT_DIVIDER;
+    params->reserved = 0;
+}
+
+/**
+ * @brief Convert appConfig.controller to loop units. Sensor sensitivity,
+ *        calibration and motion limits are taken at the time of the call.
+ *
+ * @return SCH_OK, SCH_ERR_INVALID_PARAM when a nonzero gain rounds to zero
+ *         at the current sample rate and divider
+ */
+int32_t ControllerConfigure(void)
+{
+    const ControllerParams *params = &appConfig.controller;
+    float gain;
+    float loopTime;
+
+    axis = (params->axis <= AXIS_Z) ? params->axis : CONTROLLER_DEFAULT_AXIS;
+    divider = (params->divider > 0) ? params->divider : 1;
+    gain = SCHGetRate1Gain(axis);
+    loopTime = (float)divider / (float)SampleRateGet();
+
+    setpointCounts = (int32_t)((float)params->setpoint * 0.001f / gain);
+    feedForward    = ((int64_t)params->kff * params->setpoint) / 1000;
+    kpCounts       = (int32_t)((float)params->kp * gain);
+    kiCounts       = (int64_t)((float)params->ki * gain * loopTime * (float)(1UL << CONTROLLER_KI_EXTRA_SHIFT));
+    kdCounts       = (int32_t)((float)params->kd * gain / loopTime);
+    errorScale     = gain * 1000.0f;
+
+    maxCommand = appConfig.motion.maxVelocity;
+    if (maxCommand > STEPPER_MAX_RATE)
+        maxCommand = STEPPER_MAX_RATE;
+    maxDelta = (int32_t)((float)appConfig.motion.acceleration * loopTime);
+    if (maxDelta < 1)
+        maxDelta = 1;
+
+    gainsValid = ((params->kp == 0) || (kpCounts != 0)) &&
+                 ((params->ki == 0) || (kiCounts != 0)) &&
+                 ((params->kd == 0) || (kdCounts != 0));
+    return gainsValid ? SCH_OK : SCH_ERR_INVALID_PARAM;
+}
+
+/**
+ * @brief Start or stop the loop.
+ *
+ * @return SCH_OK, SCH_ERR_OTHER when the driver is disabled or a move is running,
+ *         SCH_ERR_INVALID_PARAM when a gain rounds to zero in loop units
+ */
+int32_t ControllerEnable(bool enable)
+{
+    if (!enable) {
+        if (enabled)
+            StepperSetRate(0);
+        enabled = false;
+        command = 0;
+        return SCH_OK;
+    }
+
+    if (enabled)
+        return SCH_OK;
+    if (!StepperIsEnabled() || StepperIsRunning())
+        return SCH_ERR_OTHER;
+
+    if (ControllerConfigure() != SCH_OK)
+        return SCH_ERR_INVALID_PARAM;
+    divideCounter = 0;
+    hasPrevious = false;
+    errorSum = 0;
+    integral = 0;
+    command = 0;
+    saturated = false;
+    enabled = true;
+
+    return SCH_OK;
+}
+
+bool ControllerIsEnabled(void)
+{
+    return enabled;
+}
+
+/**
+ * Run the loop on an acquired sample. Samples with an invalid frame on the
+ * controlled axis are skipped, the last command is held.
+ */
+void ControllerUpdate(const SCHRawData *data)
+{
+    int32_t error;
+    int32_t next;
+    int64_t errorSumNext;
+    int64_t integralNext;
+    int64_t sum;
+
+    if (!enabled)
+        return;
+    if (++divideCounter < divider)
+        return;
+    divideCounter = 0;
+
+    if (data->quality & (SCH_QUALITY_RATE1_X << axis))
+        return;
+
+    error = setpointCounts - SCHGetRate1Counts(data, axis);
+    // Not integrated without ki, a later ki must not meet a stale sum
+    errorSumNext = (kiCounts != 0) ? (errorSum + error) : 0;
+    integralNext = (errorSumNext * kiCounts) >> CONTROLLER_KI_EXTRA_SHIFT;
+
+    sum = feedForward + (int64_t)kpCounts * error + integralNext;
+    if (hasPrevious)
+        sum += (int64_t)kdCounts * (error - previousError);
+    previousError = error;
+    hasPrevious = true;
+
+    sum >>= CONTROLLER_GAIN_SHIFT;
+    saturated = false;
+
+    // Velocity limit
+    if (sum > maxCommand) {
+        sum = maxCommand;
+        saturated = true;
+    }
+    else if (sum < -maxCommand) {
+        sum = -maxCommand;
+        saturated = true;
+    }
+
+    // Acceleration limit, keeps the motor from stalling on command steps
+    next = (int32_t)sum;
+    if (next > (command + maxDelta)) {
+        next = command + maxDelta;
+        saturated = true;
+    }
+    else if (next < (command - maxDelta)) {
+        next = command - maxDelta;
+        saturated = true;
+    }
+
+    if (!saturated) {
+        errorSum = errorSumNext;
+        integral = integralNext;
+    }
+
+    if (next != command) {
+        command = next;
+        if (StepperSetRate(command) != SCH_OK) {
+            // Driver disabled under the loop
+            enabled = false;
+            command = 0;
+        }
+    }
+}
+
+void ControllerGetTelemetry(ControllerTelemetry *telemetry)
+{
+    telemetry->error     = (int32_t)((float)previousError * errorScale);
+    telemetry->command   = command;
+    telemetry->integral  = (int32_t)(integral >> CONTROLLER_GAIN_SHIFT);
+    telemetry->enabled   = enabled;
+    telemetry->saturated = saturated;
+    telemetry->reserved  = 0;
+}
@@ -0,0 +1,49 @@
+#ifndef _CONTROLLER_H
+#define _CONTROLLER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "SCHsensor.h"
+
+#define CONTROLLER_GAIN_SHIFT       16      // Gains are Q16
+
+/**
+ * Default controller parameters: loop at the acquisition rate, gains zero
+ */
+#define CONTROLLER_DEFAULT_AXIS     AXIS_Z
+#define CONTROLLER_DEFAULT_DIVIDER  1
+
+/**
+ * Rate loop parameters, part of the persistent configuration. Gains are Q16
+ * in stepper and gyro units, the sign sets the direction of correction.
+ */
+typedef struct {
+    int32_t kp;                 // steps/s per dps of rate error
+    int32_t ki;                 // steps/s per dps*s of integrated error
+    int32_t kd;                 // steps/s per dps/s of error change
+    int32_t kff;                // steps/s per dps of setpoint
+    int32_t setpoint;           // Rate1 setpoint, mdps
+    uint8_t axis;               // Rate1 axis, AXIS_X/Y/Z
+    uint8_t divider;            // Loop runs on every Nth acquired sample
+    uint16_t reserved;
+} ControllerParams;
+
+/**
+ * Loop telemetry, optional section of PKT_SAMPLE (STREAM_CONTROLLER)
+ */
+typedef struct {
+    int32_t error;              // Setpoint - rate, mdps
+    int32_t command;            // Stepper velocity command, steps/s
+    int32_t integral;           // Integral term, steps/s
+    uint8_t enabled;
+    uint8_t saturated;          // Command limited by velocity or acceleration
+    uint16_t reserved;
+} ControllerTelemetry;
+
+void ControllerLoadDefaults(ControllerParams *params);
+int32_t ControllerConfigure(void);
+int32_t ControllerEnable(bool enable);
+bool ControllerIsEnabled(void);
+void ControllerUpdate(const SCHRawData *data);
+void ControllerGetTelemetry(ControllerTelemetry *telemetry);
+#endif
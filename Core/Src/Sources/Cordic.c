@@ -0,0 +1,139 @@
+/* Cordic.c
+ * Integer atan2, vector magnitude and square root for the FPU-less core.
+ *
+ * CordicVector() rotates (x, y) onto the positive x axis with shift-and-add
+ * CORDIC iterations, accumulating the rotation as a binary angle. The
+ * vector is first folded into the right half plane and normalized to
+ * 2^28..2^29, so every input range gets the same relative precision and the
+ * CORDIC gain (1.647) cannot overflow 32 bits. The magnitude is the final x
+ * divided by the gain, one 64-bit multiply.
+ */
+
+#include "Cordic.h"
+#include <stddef.h>
+
+#define CORDIC_NORM_MIN             (1L << 28)
+#define CORDIC_NORM_MAX             (1L << 29)
+#define CORDIC_INV_GAIN_Q30         652032874UL     // 2^30 / prod(sqrt(1 + 2^-2i))
+
+/**
+ * atan(2^-i) as binary angle
+ */
+static const int32_t atanTable[CORDIC_ITERATIONS] = {
+    536870912, 316933406, 167458907, 85004756, 42667331, 21354465,
+    10679838, 5340245, 2670163, 1335087, 667544, 333772,
+    166886, 83443, 41722, 20861, 10430, 5215,
+    2608, 1304, 652, 326, 163, 81
+};
+
+/**
+ * Angle of (x, y) as binary angle, magnitude to *magnitude (may be NULL).
+ * Arguments within +-CORDIC_MAX_INPUT; (0, 0) returns 0.
+ */
+int32_t CordicVector(int32_t x, int32_t y, uint32_t *magnitude)
+{
+    uint32_t angle = 0;
+    uint32_t largest;
+    int32_t shift = 0;
+    uint64_t result;
+
+    if ((x == 0) && (y == 0)) {
+        if (magnitude != NULL)
+            *magnitude = 0;
+        return 0;
+    }
+
+    // Left half plane: rotate by 180 degrees
+    if (x < 0) {
+        x = -x;
+        y = -y;
+        angle = 0x80000000UL;
+    }
+
+    largest = (uint32_t)((y < 0) ? -y : y);
+    if ((uint32_t)x > largest)
+        largest = (uint32_t)x;
+    while (largest < CORDIC_NORM_MIN) {
+        largest <<= 1;
+        shift++;
+    }
+    while (largest >= CORDIC_NORM_MAX) {
+        largest >>= 1;
+        shift--;
+    }
+    if (shift >= 0) {
+        x <<= shift;
+        y <<= shift;
+    } else {
+        x >>= -shift;
+        y >>= -shift;
+    }
+
+    for (int i = 0; i < CORDIC_ITERATIONS; i++)
+    {
+        int32_t next;
+
+        if (y > 0) {
+            next = x + (y >> i);
+            y -= x >> i;
+            angle += (uint32_t)atanTable[i];
+        } else {
+            next = x - (y >> i);
+            y += x >> i;
+            angle -= (uint32_t)atanTable[i];
+        }
+        x = next;
+    }
+
+    if (magnitude != NULL) {
+        result = ((uint64_t)(uint32_t)x * CORDIC_INV_GAIN_Q30) >> 30;
+        if (shift > 0)
+            result = (result + (1ULL << (shift - 1))) >> shift;
+        else
+            result <<= -shift;
+        *magnitude = (uint32_t)result;
+    }
+
+    return (int32_t)angle;
+}
+
+/**
+ * atan2(y, x) as binary angle
+ */
+int32_t CordicAtan2(int32_t y, int32_t x)
+{
+    return CordicVector(x, y, NULL);
+}
+
+/**
+ * Binary angle to 0.01 degrees, rounded
+ */
+int32_t CordicToCentiDegrees(int32_t angle)
+{
+    return (int32_t)(((int64_t)angle * 36000 + (1LL << 31)) >> 32);
+}
+
+/**
+ * Integer square root, 64 bit argument (digit by digit, shifts and
+ * subtractions only)
+ */
+uint32_t CordicSqrt(uint64_t value)
+{
+    uint64_t result = 0;
+    uint64_t bit = 1ULL << 62;
+
+    while (bit > value)
+        bit >>= 2;
+
+    while (bit != 0) {
+        if (value >= result + bit) {
+            value -= result + bit;
+            result = (result >> 1) + bit;
+        } else {
+            result >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return (uint32_t)result;
+}
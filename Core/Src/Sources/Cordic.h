@@ -0,0 +1,18 @@
+#ifndef _CORDIC_H
+#define _CORDIC_H
+
+#include <stdint.h>
+
+/**
+ * Binary angle: a full turn is 2^32, so int32_t covers -180..+180 degrees
+ * and wraps like an angle
+ */
+#define CORDIC_ANGLE_90             0x40000000L
+#define CORDIC_ITERATIONS           24      // Residual angle error below 0.00001 degrees
+#define CORDIC_MAX_INPUT            (1L << 30)
+
+int32_t  CordicVector(int32_t x, int32_t y, uint32_t *magnitude);
+int32_t  CordicAtan2(int32_t y, int32_t x);
+int32_t  CordicToCentiDegrees(int32_t angle);
+uint32_t CordicSqrt(uint64_t value);
+#endif
@@ -0,0 +1,10 @@
+#ifndef _CRC_H
+#define _CRC_H
+
+#include <stdint.h>
+
+#define CRC16_INIT      0xFFFF
+
+uint16_t Crc16Update(uint16_t crc, const void *data, uint32_t size);
+uint16_t Crc16(const void *data, uint32_t size);
+#endif
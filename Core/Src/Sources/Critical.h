@@ -0,0 +1,33 @@
+#ifndef _CRITICAL_H
+#define _CRITICAL_H
+
+#include "main.h"
+
+/**
+ * Interrupt priorities (NVIC_PRIORITYGROUP_4, preemption only, 0 = highest).
+ * Set in the CubeMX generated init code, keep the .ioc in sync.
+ *
+ *   0   TIM2 acquisition tick, SPI1
+ *   1   TIM4 step timer, DMA1 channel 7 step bursts, EXTI4 LIMIT, EXTI9_5 MOTOR_FLT
+ *   2   USART1, DMA1 channel 4/5 link TX/RX
+ *   15  SysTick (posts the motor and housekeeping events)
+ */
+#define IRQ_PRIORITY_MOTOR          1       // Highest priority masked by CriticalEnter()
+
+/**
+ * Critical sections mask the motor and link interrupts through BASEPRI and
+ * leave the acquisition tick running. Nestable, and safe to use from an
+ * interrupt (BASEPRI is only ever raised).
+ */
+static inline uint32_t CriticalEnter(void)
+{
+    uint32_t basepri = __get_BASEPRI();
+    __set_BASEPRI_MAX(IRQ_PRIORITY_MOTOR << (8U - __NVIC_PRIO_BITS));
+    return basepri;
+}
+
+static inline void CriticalExit(uint32_t basepri)
+{
+    __set_BASEPRI(basepri);
+}
+#endif
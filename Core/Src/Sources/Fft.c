@@ -0,0 +1,396 @@
+/* Fft.c
+ * Vibration spectrum of one Acc1 axis: 256-point Q15 real FFT with a Hann
+ * window, averaged magnitude spectra reported as band levels and peaks.
+ *
+ * The sample handler only stores the raw axis value. A complete frame is
+ * transformed in the background scheduler event, one step per event so the
+ * acquisition is never delayed by more than one step: prepare (mean
+ * removal, block scaling to 14 bits, window, even/odd packing), seven
+ * radix-2 stages of the 128-point complex FFT (1/2 scaling per stage), and
+ * the real split with magnitudes in two halves. While a frame is being
+ * transformed the next one is not collected.
+ *
+ * The input is scaled per frame by 2^exponent to use the 16-bit range;
+ * amplitudes are scaled back before averaging, so frames of different
+ * levels average correctly.
+ */
+
+#include "Fft.h"
+#include "ConfigStore.h"
+#include "Protocol.h"
+#include "Link.h"
+#include "Cordic.h"
+#include "Scheduler.h"
+#include "SampleRate.h"
+#include "main.h"
+
+#define FFT_HALF                (FFT_SIZE / 2)
+#define FFT_STAGES              7           // log2(FFT_HALF)
+#define FFT_INPUT_BITS          14          // Peak input after scaling, headroom for the butterflies
+
+#define FFT_STEP_PREPARE        0
+#define FFT_STEP_STAGE          1           // ..FFT_STAGES
+#define FFT_STEP_SPLIT_LOW      (FFT_STEP_STAGE + FFT_STAGES)
+#define FFT_STEP_SPLIT_HIGH     (FFT_STEP_SPLIT_LOW + 1)
+#define FFT_STEP_REPORT         (FFT_STEP_SPLIT_HIGH + 1)
+#define FFT_STEP_IDLE           0xFF
+
+typedef struct {
+    int16_t re;
+    int16_t im;
+} FftComplex;
+
+/**
+ * sin(2 pi k / 256), Q15, first quadrant
+ */
+static const int16_t sineTable[FFT_SIZE / 4 + 1] = {
+    0, 804, 1608, 2410, 3212, 4011, 4808, 5602,
+    6393, 7179, 7962, 8739, 9512, 10278, 11039, 11793,
+    12539, 13279, 14010, 14732, 15446, 16151, 16846, 17530,
+    18204, 18868, 19519, 20159, 20787, 21403, 22005, 22594,
+    23170, 23731, 24279, 24811, 25329, 25832, 26319, 26790,
+    27245, 27683, 28105, 28510, 28898, 29268, 29621, 29956,
+    30273, 30571, 30852, 31113, 31356, 31580, 31785, 31971,
+    32137, 32285, 32412, 32521, 32609, 32678, 32728, 32757,
+    32767,
+};
+
+// Frame collection, sample handler
+static int32_t input[FFT_SIZE];
+static uint16_t fill = 0;
+static bool inputReady = false;         // Complete frame waiting for the prepare step
+static uint8_t inputAxis;
+static uint16_t inputRate;
+static uint16_t droppedFrames = 0;
+
+// Transform, background event
+static FftComplex work[FFT_HALF];
+static uint8_t step = FFT_STEP_IDLE;
+static int8_t exponent;                 // Input scaling of the frame being transformed
+static uint8_t frameAxis;
+static uint16_t frameRate;
+static uint32_t frameCycles = 0;
+static uint32_t lastFrameCycles = 0;
+static uint32_t stepCyclesMax = 0;
+
+// Averaged spectrum
+static uint32_t amplitudeSum[FFT_BINS];
+static uint8_t averaged = 0;
+static uint8_t averageAxis;
+static uint16_t averageRate;
+
+void FftLoadDefaults(FftParams *params)
+{
+    params->axis     = FFT_DEFAULT_AXIS;
+    params->averages = FFT_DEFAULT_AVERAGES;
+    params->reserved = 0;
+}
+
+/**
+ * sin(2 pi k / 256), Q15, any k
+ */
+static int32_t FftSin(uint32_t k)
+{
+    uint32_t r = k & (FFT_SIZE / 4 - 1);
+
+    switch ((k / (FFT_SIZE / 4)) & 3)
+    {
+        case 0:  return sineTable[r];
+        case 1:  return sineTable[FFT_SIZE / 4 - r];
+        case 2:  return -sineTable[r];
+        default: return -sineTable[FFT_SIZE / 4 - r];
+    }
+}
+
+static int32_t FftCos(uint32_t k)
+{
+    return FftSin(k + FFT_SIZE / 4);
+}
+
+/**
+ * Bin magnitude, 32-bit argument (per-bin path)
+ */
+static uint32_t FftSqrt32(uint32_t value)
+{
+    uint32_t result = 0;
+    uint32_t bit = 1UL << 30;
+
+    while (bit > value)
+        bit >>= 2;
+
+    while (bit != 0) {
+        if (value >= result + bit) {
+            value -= result + bit;
+            result = (result >> 1) + bit;
+        } else {
+            result >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return result;
+}
+
+/**
+ * Store one raw sample of the configured axis. Called from the sample
+ * handler.
+ */
+void FftUpdate(const SCHRawData *data)
+{
+    uint8_t axis = appConfig.fft.axis;
+
+    if ((appConfig.streams & STREAM_SPECTRUM) == 0) {
+        fill = 0;
+        inputReady = false;
+        if (step == FFT_STEP_IDLE)
+            averaged = 0;
+        return;
+    }
+    if (inputReady)
+        return;
+
+    // Start over rather than transform a gap
+    if ((fill != 0) && (axis != inputAxis))
+        fill = 0;
+    if (data->quality & (SCH_QUALITY_ACC1_X << axis)) {
+        if ((fill != 0) && (droppedFrames < UINT16_MAX))
+            droppedFrames++;
+        fill = 0;
+        return;
+    }
+
+    inputAxis = axis;
+    input[fill++] = data->acc1Raw[axis];
+    if (fill < FFT_SIZE)
+        return;
+
+    fill = 0;
+    inputRate = (uint16_t)SampleRateGet();
+    inputReady = true;
+    if (step == FFT_STEP_IDLE) {
+        step = FFT_STEP_PREPARE;
+        SchedulerPost(SCHEDULER_EVENT_BACKGROUND);
+    }
+}
+
+/**
+ * Remove the mean, scale to FFT_INPUT_BITS, window and pack the real frame
+ * as FFT_HALF complex values in bit-reversed order
+ */
+static void FftPrepare(void)
+{
+    int32_t sum = 0;
+    int32_t mean;
+    uint32_t maxAbs = 0;
+
+    for (int n = 0; n < FFT_SIZE; n++)
+        sum += input[n];
+    mean = sum / FFT_SIZE;
+
+    for (int n = 0; n < FFT_SIZE; n++)
+    {
+        int32_t d = input[n] - mean;
+        uint32_t a = (d < 0) ? (uint32_t)-d : (uint32_t)d;
+
+        if (a > maxAbs)
+            maxAbs = a;
+    }
+    exponent = (maxAbs != 0) ? (int8_t)(FFT_INPUT_BITS - (32 - __CLZ(maxAbs))) : 0;
+
+    for (int n = 0; n < FFT_SIZE; n++)
+    {
+        int32_t q = input[n] - mean;
+        int32_t hann = (32767 - FftCos(n)) >> 1;
+        uint32_t index = __RBIT((uint32_t)n >> 1) >> (32 - FFT_STAGES);
+
+        q = (exponent >= 0) ? (q << exponent) : (q >> -exponent);
+        q = (q * hann) >> 15;
+        if (n & 1)
+            work[index].im = (int16_t)q;
+        else
+            work[index].re = (int16_t)q;
+    }
+
+    frameAxis = inputAxis;
+    frameRate = inputRate;
+    inputReady = false;
+}
+
+/**
+ * One radix-2 decimation in time stage, 1..FFT_STAGES, scaled by 1/2
+ */
+static void FftStage(int stage)
+{
+    int half = 1 << (stage - 1);
+    uint32_t twiddleStep = FFT_SIZE >> stage;
+
+    for (int j = 0; j < half; j++)
+    {
+        int32_t c = FftCos(j * twiddleStep);
+        int32_t s = FftSin(j * twiddleStep);
+
+        for (int k = j; k < FFT_HALF; k += 2 * half)
+        {
+            FftComplex *a = &work[k];
+            FftComplex *b = &work[k + half];
+            int32_t tRe = (b->re * c + b->im * s) >> 15;
+            int32_t tIm = (b->im * c - b->re * s) >> 15;
+
+            b->re = (int16_t)((a->re - tRe) >> 1);
+            b->im = (int16_t)((a->im - tIm) >> 1);
+            a->re = (int16_t)((a->re + tRe) >> 1);
+            a->im = (int16_t)((a->im + tIm) >> 1);
+        }
+    }
+}
+
+/**
+ * Real spectrum bins first..last from the half-size complex FFT, magnitudes
+ * added to the average
+ */
+static void FftSplit(int first, int last)
+{
+    for (int k = first; k <= last; k++)
+    {
+        const FftComplex *a = &work[k & (FFT_HALF - 1)];
+        const FftComplex *b = &work[(FFT_HALF - k) & (FFT_HALF - 1)];
+        int32_t c = FftCos(k);
+        int32_t s = FftSin(k);
+        // Even part (A + B*) / 2, odd part -j (A - B*) / 2
+        int32_t evenRe = (a->re + b->re) >> 1;
+        int32_t evenIm = (a->im - b->im) >> 1;
+        int32_t oddRe  = (a->im + b->im) >> 1;
+        int32_t oddIm  = (b->re - a->re) >> 1;
+        int32_t re = evenRe + ((oddRe * c + oddIm * s) >> 15);
+        int32_t im = evenIm + ((oddIm * c - oddRe * s) >> 15);
+        uint32_t magnitude = FftSqrt32((uint32_t)(re * re + im * im));
+        uint32_t amplitude;
+
+        // |DFT| / 64 is the amplitude of a sine under the Hann window, Q4
+        if (exponent <= 5)
+            amplitude = magnitude << (5 - exponent);
+        else
+            amplitude = magnitude >> (exponent - 5);
+
+        amplitudeSum[k] = (amplitudeSum[k] > UINT32_MAX - amplitude) ? UINT32_MAX : amplitudeSum[k] + amplitude;
+    }
+}
+
+/**
+ * Band levels and peaks of the averaged spectrum
+ */
+static void FftReport(void)
+{
+    PktSpectrum pkt;
+    int peaks = 0;
+
+    pkt.binMilliHz = ((uint32_t)averageRate * 1000U) / FFT_SIZE;
+    pkt.fftCycles = lastFrameCycles;
+    pkt.stepCyclesMax = stepCyclesMax;
+    pkt.sampleRate = averageRate;
+    pkt.axis = averageAxis;
+    pkt.averages = averaged;
+    pkt.droppedFrames = droppedFrames;
+    pkt.reserved = 0;
+
+    for (int band = 0; band < FFT_BANDS; band++)
+    {
+        uint64_t sum = 0;
+
+        for (int k = 1 + band * (FFT_HALF / FFT_BANDS); k <= (band + 1) * (FFT_HALF / FFT_BANDS); k++)
+        {
+            uint64_t amplitude = amplitudeSum[k] / averaged;
+            sum += amplitude * amplitude;
+        }
+        pkt.band[band] = CordicSqrt(sum);
+    }
+
+    for (int i = 0; i < FFT_PEAKS; i++) {
+        pkt.peak[i].amplitude = 0;
+        pkt.peak[i].bin = 0;
+        pkt.peak[i].reserved = 0;
+    }
+    // Local maxima, insertion into the sorted list (sums compare as averages)
+    for (int k = 1; k < FFT_HALF; k++)
+    {
+        uint32_t value = amplitudeSum[k];
+        int i;
+
+        if ((value <= amplitudeSum[k - 1]) || (value < amplitudeSum[k + 1]))
+            continue;
+        for (i = peaks; (i > 0) && (pkt.peak[i - 1].amplitude < value); i--) {
+            if (i < FFT_PEAKS)
+                pkt.peak[i] = pkt.peak[i - 1];
+        }
+        if (i < FFT_PEAKS) {
+            pkt.peak[i].amplitude = value;
+            pkt.peak[i].bin = (uint16_t)k;
+            if (peaks < FFT_PEAKS)
+                peaks++;
+        }
+    }
+    for (int i = 0; i < peaks; i++)
+        pkt.peak[i].amplitude /= averaged;
+
+    LinkSend(PKT_SPECTRUM, &pkt, sizeof(pkt));
+
+    averaged = 0;
+    stepCyclesMax = 0;
+    droppedFrames = 0;
+}
+
+/**
+ * Run one transform step. Handler of SCHEDULER_EVENT_BACKGROUND, posts
+ * itself again until the frame is done.
+ */
+void FftBackground(void)
+{
+    uint32_t start = DWT->CYCCNT;
+    uint32_t cycles;
+    uint8_t averages = appConfig.fft.averages;
+    uint8_t ran = step;
+
+    if (step == FFT_STEP_IDLE)
+        return;
+
+    if (step == FFT_STEP_PREPARE) {
+        frameCycles = 0;
+        FftPrepare();
+        step++;
+    } else if (step < FFT_STEP_SPLIT_LOW) {
+        FftStage(step - FFT_STEP_STAGE + 1);
+        step++;
+    } else if (step == FFT_STEP_SPLIT_LOW) {
+        // A new axis or rate starts a new average
+        if ((averaged == 0) || (frameAxis != averageAxis) || (frameRate != averageRate)) {
+            for (int k = 0; k < FFT_BINS; k++)
+                amplitudeSum[k] = 0;
+            averaged = 0;
+            averageAxis = frameAxis;
+            averageRate = frameRate;
+        }
+        FftSplit(0, FFT_HALF / 2);
+        step++;
+    } else if (step == FFT_STEP_SPLIT_HIGH) {
+        FftSplit(FFT_HALF / 2 + 1, FFT_HALF);
+        averaged++;
+        step = (averaged >= averages) ? FFT_STEP_REPORT : FFT_STEP_IDLE;
+    } else {
+        FftReport();
+        step = FFT_STEP_IDLE;
+    }
+
+    cycles = DWT->CYCCNT - start;
+    if (cycles > stepCyclesMax)
+        stepCyclesMax = cycles;
+    if (ran <= FFT_STEP_SPLIT_HIGH)
+        frameCycles += cycles;
+    if (ran == FFT_STEP_SPLIT_HIGH)
+        lastFrameCycles = frameCycles;
+
+    // Next frame already collected
+    if ((step == FFT_STEP_IDLE) && inputReady)
+        step = FFT_STEP_PREPARE;
+    if (step != FFT_STEP_IDLE)
+        SchedulerPost(SCHEDULER_EVENT_BACKGROUND);
+}
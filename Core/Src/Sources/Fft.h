@@ -0,0 +1,56 @@
+#ifndef _FFT_H
+#define _FFT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "SCHSensor.h"
+
+#define FFT_SIZE                    256     // Real samples per transform
+#define FFT_BINS                    (FFT_SIZE / 2 + 1)
+#define FFT_BANDS                   16      // Linear bands of 8 bins, DC excluded
+#define FFT_PEAKS                   4
+#define FFT_MAX_AVERAGES            32
+
+/**
+ * Default spectrum: Acc1 Z, 8 averaged transforms per report
+ */
+#define FFT_DEFAULT_AXIS            AXIS_Z
+#define FFT_DEFAULT_AVERAGES        8
+
+/**
+ * Spectrum parameters, part of the persistent configuration
+ */
+typedef struct {
+    uint8_t  axis;              // Acc1 axis, AXIS_X/Y/Z
+    uint8_t  averages;          // Magnitude spectra averaged per report, 1..FFT_MAX_AVERAGES
+    uint16_t reserved;
+} FftParams;
+
+typedef struct {
+    uint32_t amplitude;         // Q4 LSB
+    uint16_t bin;               // Frequency = bin * binMilliHz / 1000
+    uint16_t reserved;
+} FftPeak;
+
+/**
+ * PKT_SPECTRUM payload (STREAM_SPECTRUM). Amplitudes are averaged bin
+ * magnitudes of the Hann windowed, mean removed axis, scaled so that a
+ * sine of amplitude A LSB reads A.
+ */
+typedef struct {
+    uint32_t binMilliHz;        // Bin spacing, sample rate / FFT_SIZE
+    uint32_t fftCycles;         // DWT cycles of the last transform, all background steps
+    uint32_t stepCyclesMax;     // Longest single background step since the last report
+    uint16_t sampleRate;        // Hz
+    uint8_t  axis;
+    uint8_t  averages;
+    uint16_t droppedFrames;     // Frames discarded for a frame error since the last report
+    uint16_t reserved;
+    uint32_t band[FFT_BANDS];   // Q4 LSB, root of the summed squared bin amplitudes
+    FftPeak  peak[FFT_PEAKS];   // Largest local maxima, highest first, bin 0 = none
+} PktSpectrum;
+
+void FftLoadDefaults(FftParams *params);
+void FftUpdate(const SCHRawData *data);
+void FftBackground(void);
+#endif
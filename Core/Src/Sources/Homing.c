@@ -0,0 +1,188 @@
+/* Homing.c
+ * LIMIT switch handling and homing sequence.
+ *
+ * The switch edge stops step generation directly from the EXTI interrupt
+ * when the motor is moving towards the switch, and latches the position
+ * at the edge. Homing runs from the main loop as a state machine so the
+ * sensor stream is not interrupted:
+ *
+ *   fast approach -> back off -> slow approach -> position latched
+ *
+ * The switch point seen on the slow approach becomes the configured offset.
+ */
+
+#include "Homing.h"
+#include "Stepper.h"
+#include "Motion.h"
+#include "Controller.h"
+#include "ConfigStore.h"
+#include "Scheduler.h"
+#include "Trace.h"
+
+static HomingState state = HOMING_IDLE;
+static volatile bool limitTripped = false;      // Set by the EXTI interrupt
+static volatile int32_t limitPosition = 0;      // Step position at the switch edge
+
+void HomingLoadDefaults(HomingParams *params)
+{
+    params->fastVelocity = HOMING_DEFAULT_FAST_VELOCITY;
+    params->slowVelocity = HOMING_DEFAULT_SLOW_VELOCITY;
+    params->backoff      = HOMING_DEFAULT_BACKOFF;
+    params->offset       = 0;
+    params->travel       = HOMING_DEFAULT_TRAVEL;
+    params->direction    = HOMING_DEFAULT_DIRECTION;
+    params->reserved[0]  = 0;
+    params->reserved[1]  = 0;
+    params->reserved[2]  = 0;
+}
+
+bool HomingLimitActive(void)
+{
+    return HAL_GPIO_ReadPin(LIMIT_GPIO_Port, LIMIT_Pin) == HOMING_LIMIT_ACTIVE;
+}
+
+/**
+ * EXTI4 interrupt, called from EXTI4_IRQHandler(). Edges while moving away
+ * from the switch (contact bounce on release) are ignored.
+ */
+void HomingLimitIrq(void)
+{
+    if (!HomingLimitActive())
+        return;
+    if (!StepperIsRunning() || (StepperGetDirection() != appConfig.homing.direction))
+        return;
+
+    StepperStop();
+    limitPosition = StepperGetPosition();
+    limitTripped = true;
+    TraceWrite(TRACE_LIMIT, (uint16_t)limitPosition);
+    SchedulerPost(SCHEDULER_EVENT_MOTOR);
+}
+
+/**
+ * Ramp up towards the switch, bounded by the configured travel
+ */
+static bool HomingApproach(int32_t velocity)
+{
+    limitTripped = false;
+    return MotionQueue(appConfig.homing.direction * appConfig.homing.travel, velocity) == SCH_OK;
+}
+
+/**
+ * @brief Start the homing sequence.
+ *
+ * @return SCH_OK, SCH_ERR_OTHER when the driver is disabled or the motor is in use
+ */
+int32_t HomingStart(void)
+{
+    const HomingParams *params = &appConfig.homing;
+
+    if (HomingIsBusy() || MotionIsBusy() || ControllerIsEnabled())
+        return SCH_ERR_OTHER;
+    if (!StepperIsEnabled() || StepperIsRunning())
+        return SCH_ERR_OTHER;
+
+    // Starting on the switch: skip the fast approach
+    if (HomingLimitActive()) {
+        if (MotionMove(-params->direction * params->backoff) != SCH_OK)
+            return SCH_ERR_OTHER;
+        state = HOMING_BACKOFF;
+        return SCH_OK;
+    }
+
+    if (!HomingApproach(params->fastVelocity))
+        return SCH_ERR_OTHER;
+    state = HOMING_FAST_APPROACH;
+
+    return SCH_OK;
+}
+
+/**
+ * Stop the motor and abandon homing
+ */
+void HomingAbort(void)
+{
+    if (!HomingIsBusy())
+        return;
+
+    StepperStop();
+    state = HOMING_IDLE;
+}
+
+/**
+ * Advance the homing sequence. Called from the main loop.
+ */
+void HomingPoll(void)
+{
+    const HomingParams *params = &appConfig.homing;
+    // Read before limitTripped: a stop by the switch edge in between is not a failure
+    bool moving = MotionIsBusy();
+
+    if (!HomingIsBusy()) {
+        // Switch hit during a normal move: make sure nothing restarts the motor
+        if (limitTripped) {
+            limitTripped = false;
+            ControllerEnable(false);
+        }
+        return;
+    }
+
+    switch (state)
+    {
+        case HOMING_FAST_APPROACH:
+            if (limitTripped) {
+                // Motion drops the cut-short run on its next poll
+                if (moving)
+                    break;
+                limitTripped = false;
+                if (MotionMove(-params->direction * params->backoff) != SCH_OK)
+                    state = HOMING_FAILED;
+                else
+                    state = HOMING_BACKOFF;
+            }
+            else if (!moving) {
+                // Full travel without reaching the switch
+                state = HOMING_FAILED;
+            }
+            break;
+
+        case HOMING_BACKOFF:
+            if (MotionIsBusy())
+                break;
+            // Still on the switch: back off too short or switch stuck
+            if (HomingLimitActive() || !HomingApproach(params->slowVelocity))
+                state = HOMING_FAILED;
+            else
+                state = HOMING_SLOW_APPROACH;
+            break;
+
+        case HOMING_SLOW_APPROACH:
+            if (limitTripped) {
+                if (moving)
+                    break;
+                limitTripped = false;
+                StepperSetPosition(params->offset + (StepperGetPosition() - limitPosition));
+                state = HOMING_DONE;
+            }
+            else if (!moving) {
+                state = HOMING_FAILED;
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+HomingState HomingGetState(void)
+{
+    return state;
+}
+
+/**
+ * Homing sequence in progress
+ */
+bool HomingIsBusy(void)
+{
+    return (state == HOMING_FAST_APPROACH) || (state == HOMING_BACKOFF) || (state == HOMING_SLOW_APPROACH);
+}
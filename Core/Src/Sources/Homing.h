@@ -0,0 +1,53 @@
+#ifndef _HOMING_H
+#define _HOMING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "main.h"
+
+/**
+ * LIMIT input (PA4, EXTI4): switch to GND with internal pull-up,
+ * the falling edge marks the switch point.
+ */
+#define HOMING_LIMIT_ACTIVE             GPIO_PIN_RESET
+
+/**
+ * Default homing parameters (steps, s)
+ */
+#define HOMING_DEFAULT_DIRECTION        -1      // Limit switch at the negative end
+#define HOMING_DEFAULT_FAST_VELOCITY    1600
+#define HOMING_DEFAULT_SLOW_VELOCITY    200
+#define HOMING_DEFAULT_BACKOFF          400
+#define HOMING_DEFAULT_TRAVEL           64000   // 20 revolutions at 3200 steps/rev
+
+typedef enum {
+    HOMING_IDLE = 0,
+    HOMING_FAST_APPROACH,
+    HOMING_BACKOFF,
+    HOMING_SLOW_APPROACH,
+    HOMING_DONE,
+    HOMING_FAILED
+} HomingState;
+
+/**
+ * Homing parameters, part of the persistent configuration
+ */
+typedef struct {
+    int32_t fastVelocity;       // steps/s, first approach
+    int32_t slowVelocity;       // steps/s, re-approach that latches the position
+    int32_t backoff;            // steps moved off the switch between approaches
+    int32_t offset;             // Position assigned to the switch point
+    int32_t travel;             // steps, longest approach before homing fails
+    int8_t  direction;          // Side of the limit switch, -1 or +1
+    uint8_t reserved[3];
+} HomingParams;
+
+void HomingLoadDefaults(HomingParams *params);
+int32_t HomingStart(void);
+void HomingAbort(void);
+void HomingPoll(void);
+HomingState HomingGetState(void);
+bool HomingIsBusy(void);
+bool HomingLimitActive(void);
+void HomingLimitIrq(void);
+#endif
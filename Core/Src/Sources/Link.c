@@ -0,0 +1,345 @@
+/* Link.c
+ * Framed packet link on USART1.
+ *
+ * TX: frames are copied into a ring buffer and drained by DMA in contiguous
+ *     chunks, the next chunk is started from the TX complete callback.
+ *     LinkSendPolled() bypasses both for the fault handlers.
+ * RX: USART1 receives continuously into a circular DMA buffer, LinkPoll()
+ *     parses new bytes and hands complete frames to CommandProcess(). Line
+ *     idle and DMA half/full events schedule LinkPoll().
+ */
+
+#include "Link.h"
+#include "Command.h"
+#include "Crc.h"
+#include "Scheduler.h"
+#include "Critical.h"
+#include "Profiler.h"
+#include "Trace.h"
+#include "main.h"
+#include "usart.h"
+#include <string.h>
+
+typedef enum {
+    RX_SYNC1,
+    RX_SYNC2,
+    RX_TYPE,
+    RX_LEN,
+    RX_PAYLOAD,
+    RX_CRC_L,
+    RX_CRC_H
+} LinkRxState;
+
+static uint8_t txBuffer[LINK_TX_BUFFER_SIZE];
+static volatile uint16_t txHead = 0;        // Next free byte, written by LinkSend()
+static volatile uint16_t txTail = 0;        // First byte not yet sent, advanced from DMA callback
+static volatile uint16_t txDmaLength = 0;   // Bytes in flight, 0 = DMA idle
+
+static uint8_t rxDma[LINK_RX_DMA_SIZE];
+static uint16_t rxReadPos = 0;
+static volatile bool rxRestart = false;
+
+static LinkRxState rxState = RX_SYNC1;
+static uint8_t rxType;
+static uint8_t rxLength;
+static uint8_t rxIndex;
+static uint16_t rxCrc;
+static uint8_t rxPayload[LINK_MAX_PAYLOAD];
+
+static LinkStats linkStats;
+
+/**
+ * Start DMA on the next contiguous chunk. Called with interrupts disabled
+ * or from the TX complete interrupt.
+ */
+static void LinkStartTx(void)
+{
+    uint16_t head = txHead;
+    uint16_t tail = txTail;
+    uint16_t length;
+
+    if (head == tail)
+        return;
+
+    length = (head > tail) ? (head - tail) : (LINK_TX_BUFFER_SIZE - tail);
+    txDmaLength = length;
+
+    if (HAL_UART_Transmit_DMA(&huart1, &txBuffer[tail], length) != HAL_OK)
+        txDmaLength = 0;
+    else
+        TraceWrite(TRACE_TX_START, length);
+}
+
+static void LinkCopyToTx(uint16_t *head, const void *data, uint16_t size)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+
+    while (size--)
+    {
+        txBuffer[*head] = *bytes++;
+        *head = (*head + 1) % LINK_TX_BUFFER_SIZE;
+    }
+}
+
+/**
+ * @brief Initialize the link and start reception.
+ *
+ * @param baudRate - USART1 baud rate, re-initializes the UART when it differs
+ *                   from the CubeMX setting
+ */
+void LinkInit(uint32_t baudRate)
+{
+    if ((baudRate != 0) && (baudRate != huart1.Init.BaudRate)) {
+        huart1.Init.BaudRate = baudRate;
+        if (HAL_UART_Init(&huart1) != HAL_OK)
+            Error_Handler();
+    }
+
+    memset(&linkStats, 0, sizeof(linkStats));
+    HAL_UARTEx_ReceiveToIdle_DMA(&huart1, rxDma, LINK_RX_DMA_SIZE);
+}
+
+/**
+ * Free space in TX buffer (bytes)
+ */
+uint16_t LinkTxFree(void)
+{
+    uint16_t used = (uint16_t)((txHead - txTail + LINK_TX_BUFFER_SIZE) % LINK_TX_BUFFER_SIZE);
+
+    return (uint16_t)(LINK_TX_BUFFER_SIZE - 1 - used);
+}
+
+/**
+ * @brief Wait until every queued frame has left the UART.
+ *
+ * @param timeoutMs - longest wait in ms
+ * @return false on timeout
+ */
+bool LinkTxFlush(uint32_t timeoutMs)
+{
+    uint32_t start = HAL_GetTick();
+
+    while ((txHead != txTail) || (txDmaLength != 0) || ((huart1.Instance->SR & USART_SR_TC) == 0)) {
+        if ((HAL_GetTick() - start) >= timeoutMs)
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Queue one frame for transmission.
+ *
+ * @param type - PKT_xxx
+ * @param payload - frame payload
+ * @param size - payload size in bytes
+ * @return false when the frame did not fit in the TX buffer and was dropped
+ */
+bool LinkSend(uint8_t type, const void *payload, uint8_t size)
+{
+    uint8_t header[LINK_HEADER_SIZE] = {LINK_SYNC1, LINK_SYNC2, type, size};
+    uint8_t crc[LINK_CRC_SIZE];
+    uint16_t crcValue;
+    uint16_t head;
+    uint32_t basepri;
+    PROF_START(PROF_LINK_SEND);
+
+    crcValue = Crc16Update(CRC16_INIT, &header[2], 2);
+    crcValue = Crc16Update(crcValue, payload, size);
+    crc[0] = (uint8_t)(crcValue & 0xFF);
+    crc[1] = (uint8_t)(crcValue >> 8);
+
+    basepri = CriticalEnter();
+
+    if (LinkTxFree() < (uint16_t)(size + LINK_HEADER_SIZE + LINK_CRC_SIZE)) {
+        linkStats.txDropped++;
+        CriticalExit(basepri);
+        TraceWrite(TRACE_TX_DROP, type);
+        PROF_END(PROF_LINK_SEND);
+        return false;
+    }
+
+    head = txHead;
+    LinkCopyToTx(&head, header, LINK_HEADER_SIZE);
+    LinkCopyToTx(&head, payload, size);
+    LinkCopyToTx(&head, crc, LINK_CRC_SIZE);
+    txHead = head;
+    linkStats.txFrames++;
+
+    if (txDmaLength == 0)
+        LinkStartTx();
+
+    CriticalExit(basepri);
+    PROF_END(PROF_LINK_SEND);
+
+    return true;
+}
+
+static void LinkPutPolled(const void *data, uint16_t size)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+
+    while (size--)
+    {
+        while ((huart1.Instance->SR & USART_SR_TXE) == 0)
+            ;
+        huart1.Instance->DR = *bytes++;
+    }
+}
+
+/**
+ * @brief Send one frame by polling USART1, without the TX buffer and DMA.
+ *
+ * For fault handlers, where the DMA and UART interrupts no longer run. A
+ * DMA transfer in progress is cut off, the host resynchronizes on the
+ * next sync bytes. Returns when the last byte has left the UART.
+ *
+ * @param type - PKT_xxx
+ * @param payload - frame payload
+ * @param size - payload size in bytes
+ */
+void LinkSendPolled(uint8_t type, const void *payload, uint8_t size)
+{
+    uint8_t header[LINK_HEADER_SIZE] = {LINK_SYNC1, LINK_SYNC2, type, size};
+    uint8_t crc[LINK_CRC_SIZE];
+    uint16_t crcValue;
+
+    crcValue = Crc16Update(CRC16_INIT, &header[2], 2);
+    crcValue = Crc16Update(crcValue, payload, size);
+    crc[0] = (uint8_t)(crcValue & 0xFF);
+    crc[1] = (uint8_t)(crcValue >> 8);
+
+    // Fault before the UART was initialized
+    if ((huart1.Instance->CR1 & USART_CR1_UE) == 0)
+        return;
+
+    huart1.Instance->CR3 &= ~USART_CR3_DMAT;
+    LinkPutPolled(header, LINK_HEADER_SIZE);
+    LinkPutPolled(payload, size);
+    LinkPutPolled(crc, LINK_CRC_SIZE);
+    while ((huart1.Instance->SR & USART_SR_TC) == 0)
+        ;
+}
+
+/**
+ * Feed one received byte to the frame parser
+ */
+static void LinkParseByte(uint8_t byte)
+{
+    switch (rxState)
+    {
+        case RX_SYNC1:
+            if (byte == LINK_SYNC1)
+                rxState = RX_SYNC2;
+            break;
+
+        case RX_SYNC2:
+            rxState = (byte == LINK_SYNC2) ? RX_TYPE : RX_SYNC1;
+            break;
+
+        case RX_TYPE:
+            rxType = byte;
+            rxCrc = Crc16Update(CRC16_INIT, &byte, 1);
+            rxState = RX_LEN;
+            break;
+
+        case RX_LEN:
+            rxLength = byte;
+            rxIndex = 0;
+            rxCrc = Crc16Update(rxCrc, &byte, 1);
+            rxState = (rxLength > 0) ? RX_PAYLOAD : RX_CRC_L;
+            break;
+
+        case RX_PAYLOAD:
+            rxPayload[rxIndex++] = byte;
+            if (rxIndex >= rxLength) {
+                rxCrc = Crc16Update(rxCrc, rxPayload, rxLength);
+                rxState = RX_CRC_L;
+            }
+            break;
+
+        case RX_CRC_L:
+            if (byte == (uint8_t)(rxCrc & 0xFF)) {
+                rxState = RX_CRC_H;
+            }
+            else {
+                linkStats.rxCrcErrors++;
+                rxState = RX_SYNC1;
+            }
+            break;
+
+        case RX_CRC_H:
+            if (byte == (uint8_t)(rxCrc >> 8)) {
+                linkStats.rxFrames++;
+                CommandProcess(rxType, rxPayload, rxLength);
+            }
+            else {
+                linkStats.rxCrcErrors++;
+            }
+            rxState = RX_SYNC1;
+            break;
+
+        default:
+            rxState = RX_SYNC1;
+            break;
+    }
+}
+
+/**
+ * Parse bytes received since the last call. Called from the main loop.
+ */
+void LinkPoll(void)
+{
+    uint16_t writePos;
+
+    if (rxRestart) {
+        rxRestart = false;
+        rxReadPos = 0;
+        rxState = RX_SYNC1;
+        HAL_UARTEx_ReceiveToIdle_DMA(&huart1, rxDma, LINK_RX_DMA_SIZE);
+    }
+
+    writePos = LINK_RX_DMA_SIZE - (uint16_t)__HAL_DMA_GET_COUNTER(huart1.hdmarx);
+
+    if (writePos >= LINK_RX_DMA_SIZE)
+        writePos = 0;
+
+    while (rxReadPos != writePos)
+    {
+        LinkParseByte(rxDma[rxReadPos]);
+        rxReadPos = (rxReadPos + 1) % LINK_RX_DMA_SIZE;
+    }
+}
+
+void LinkGetStats(LinkStats *stats)
+{
+    *stats = linkStats;
+}
+
+/**
+ * HAL callbacks, forwarded from main.c
+ */
+void LinkTxCpltCallback(void)
+{
+    TraceWrite(TRACE_TX_DONE, txDmaLength);
+    txTail = (txTail + txDmaLength) % LINK_TX_BUFFER_SIZE;
+    txDmaLength = 0;
+    LinkStartTx();
+}
+
+void LinkRxEventCallback(void)
+{
+    // Reception runs continuously in circular mode, data is parsed in LinkPoll().
+    TraceWrite(TRACE_RX_EVENT, 0);
+    SchedulerPost(SCHEDULER_EVENT_COMMAND);
+}
+
+void LinkErrorCallback(void)
+{
+    // Overrun errors abort the DMA reception, LinkPoll() restarts it.
+    // Transmission is not affected.
+    if (huart1.RxState == HAL_UART_STATE_READY) {
+        rxRestart = true;
+        SchedulerPost(SCHEDULER_EVENT_COMMAND);
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef _LINK_H
+#define _LINK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "Protocol.h"
+
+/**
+ * Buffer sizes
+ */
+#define LINK_TX_BUFFER_SIZE         1024    // Frames queued for DMA transmission
+#define LINK_RX_DMA_SIZE            128     // Circular DMA reception buffer
+#define LINK_TX_FLUSH_TIMEOUT_MS    200     // Full TX buffer at 115200 baud is ~90 ms
+
+typedef struct {
+    uint32_t txFrames;
+    uint32_t txDropped;         // Frames rejected because the TX buffer was full
+    uint32_t rxFrames;
+    uint32_t rxCrcErrors;
+} LinkStats;
+
+void LinkInit(uint32_t baudRate);
+bool LinkSend(uint8_t type, const void *payload, uint8_t size);
+void LinkSendPolled(uint8_t type, const void *payload, uint8_t size);
+uint16_t LinkTxFree(void);
+bool LinkTxFlush(uint32_t timeoutMs);
+void LinkPoll(void);
+void LinkGetStats(LinkStats *stats);
+void LinkTxCpltCallback(void);
+void LinkRxEventCallback(void);
+void LinkErrorCallback(void);
+#endif
@@ -0,0 +1,429 @@
+/* Motion.c
+ * Trapezoidal and S-curve move planner for the stepper.
+ *
+ * Moves (blocks) are queued from the host and stepped out back to back. A
+ * block is cut into segments of about MOTION_SEGMENT_TIME_S, each a run of
+ * steps at one constant interval. Segments are computed in the main loop and
+ * queued to the stepper, the step interrupt only copies intervals so its cost
+ * does not depend on the profile.
+ *
+ * Look-ahead: whenever a block is queued, the entry velocity of every
+ * waiting block is planned backwards from a stop after the newest one,
+ *
+ *   entry[i] = min(junction[i], sqrt(entry[i+1]^2 + 2 * a * steps[i]))
+ *
+ * The junction velocity is the lower of the two block velocities, or the
+ * start velocity on a direction reversal. The block being stepped out starts
+ * to decelerate when its remaining steps reach the distance needed to slow
+ * down to the entry velocity of the next block; rounding left at the end is
+ * stepped out at that velocity.
+ */
+
+#include "Motion.h"
+#include "Stepper.h"
+#include "ConfigStore.h"
+#include <math.h>
+
+/**
+ * Queued move, not yet started
+ */
+typedef struct {
+    int32_t steps;              // Signed relative distance
+    float   vMax;               // Block velocity, steps/s
+    float   entry;              // Planned entry velocity, steps/s
+} MotionBlock;
+
+static MotionBlock blocks[MOTION_QUEUE_SIZE];
+static uint8_t blockHead = 0;
+static uint8_t blockTail = 0;
+
+static bool active = false;             // Segments of the current run still to be queued
+static int8_t moveDir = 1;
+static uint32_t remaining = 0;          // Steps of the current block not yet queued
+static bool decelerating = false;
+static float velocity;                  // Velocity of the next segment, steps/s
+static float acceleration;              // S-curve acceleration, steps/s^2
+static float vMax;                      // Velocity of the current block
+static float vEnd;                      // Velocity at the end of the current block
+
+// Parameters latched at run start
+static uint8_t profile;
+static float vMin;
+static float aMax;
+static float aPlan;                     // Acceleration used by the look-ahead
+static float jMax;
+
+static MotionStats stats;
+
+void MotionLoadDefaults(MotionParams *params)
+{
+    params->maxVelocity   = MOTION_DEFAULT_MAX_VELOCITY;
+    params->acceleration  = MOTION_DEFAULT_ACCELERATION;
+    params->jerk          = MOTION_DEFAULT_JERK;
+    params->startVelocity = MOTION_DEFAULT_START_VELOCITY;
+    params->profile       = MOTION_PROFILE_TRAPEZOID;
+    params->reserved[0]   = 0;
+    params->reserved[1]   = 0;
+    params->reserved[2]   = 0;
+}
+
+static uint8_t MotionQueueDepth(void)
+{
+    return (uint8_t)((blockHead - blockTail) & (MOTION_QUEUE_SIZE - 1));
+}
+
+/**
+ * Steps needed to slow down from the current state to vEnd
+ */
+static float MotionStopDistance(void)
+{
+    float v = velocity;
+    float distance = 0.0f;
+    float dv;
+    float time;
+
+    if (profile == MOTION_PROFILE_TRAPEZOID)
+        return (v > vEnd) ? ((v * v - vEnd * vEnd) / (2.0f * aMax)) : 0.0f;
+
+    // Still accelerating: acceleration has to ramp down to zero first
+    if (acceleration > 0.0f) {
+        float rampTime = acceleration / jMax;
+        float v1 = v + 0.5f * acceleration * rampTime;
+
+        distance = 0.5f * (v + v1) * rampTime;
+        v = v1;
+    }
+
+    dv = v - vEnd;
+    if (dv <= 0.0f)
+        return distance;
+
+    // Symmetric S-curve, with or without a constant deceleration phase
+    if (dv >= (aMax * aMax / jMax))
+        time = dv / aMax + aMax / jMax;
+    else
+        time = 2.0f * sqrtf(dv / jMax);
+
+    return distance + 0.5f * (v + vEnd) * time;
+}
+
+/**
+ * Advance velocity (and acceleration) over one segment of dt seconds
+ */
+static void MotionAdvance(float dt)
+{
+    if (profile == MOTION_PROFILE_TRAPEZOID) {
+        if (decelerating)
+            velocity -= aMax * dt;
+        else if (velocity < vMax)
+            velocity += aMax * dt;
+    }
+    else {
+        float previous = acceleration;
+        float target;
+        float step = jMax * dt;
+
+        // Ramp acceleration back to zero early enough to meet vMax / vEnd without overshoot
+        if (decelerating)
+            target = ((velocity - acceleration * acceleration / (2.0f * jMax)) <= vEnd) ? 0.0f : -aMax;
+        else
+            target = ((velocity + acceleration * acceleration / (2.0f * jMax)) >= vMax) ? 0.0f : aMax;
+
+        if (acceleration < target)
+            acceleration = (acceleration + step < target) ? (acceleration + step) : target;
+        else
+            acceleration = (acceleration - step > target) ? (acceleration - step) : target;
+
+        velocity += 0.5f * (previous + acceleration) * dt;
+    }
+
+    if (velocity >= vMax) {
+        velocity = vMax;
+        if (acceleration > 0.0f)
+            acceleration = 0.0f;
+    }
+    if (decelerating && (velocity <= vEnd)) {
+        velocity = vEnd;
+        if (acceleration < 0.0f)
+            acceleration = 0.0f;
+    }
+    if (velocity <= vMin) {
+        velocity = vMin;
+        if (acceleration < 0.0f)
+            acceleration = 0.0f;
+    }
+}
+
+/**
+ * Look-ahead over the waiting blocks, sets their entry velocities and the
+ * end velocity of the current block
+ */
+static void MotionPlan(void)
+{
+    float exitVelocity = vMin;
+    uint8_t index = blockHead;
+
+    while (index != blockTail)
+    {
+        MotionBlock *block;
+        float previousMax;
+        int32_t previousSteps;
+        float limit;
+        float junction;
+
+        index = (index - 1) & (MOTION_QUEUE_SIZE - 1);
+        block = &blocks[index];
+
+        // Oldest waiting block joins the block being stepped out
+        if (index == blockTail) {
+            previousMax = vMax;
+            previousSteps = moveDir;
+        }
+        else {
+            const MotionBlock *previous = &blocks[(index - 1) & (MOTION_QUEUE_SIZE - 1)];
+
+            previousMax = previous->vMax;
+            previousSteps = previous->steps;
+        }
+
+        if ((previousSteps < 0) != (block->steps < 0))
+            junction = vMin;
+        else
+            junction = (previousMax < block->vMax) ? previousMax : block->vMax;
+
+        limit = sqrtf(exitVelocity * exitVelocity + 2.0f * aPlan * (float)((block->steps < 0) ? -block->steps : block->steps));
+        block->entry = (junction < limit) ? junction : limit;
+        exitVelocity = block->entry;
+    }
+
+    // More room at the end of the current block: re-check the deceleration point
+    if (exitVelocity > vEnd)
+        decelerating = false;
+    vEnd = exitVelocity;
+}
+
+/**
+ * Make the oldest waiting block the current one
+ */
+static void MotionNextBlock(void)
+{
+    const MotionBlock *block = &blocks[blockTail];
+    int8_t dir = (block->steps < 0) ? -1 : 1;
+
+    if (active && (dir != moveDir)) {
+        velocity = vMin;
+        acceleration = 0.0f;
+    }
+    if (velocity > block->vMax)
+        velocity = block->vMax;
+
+    moveDir = dir;
+    remaining = (uint32_t)((block->steps < 0) ? -block->steps : block->steps);
+    vMax = (block->vMax > vMin) ? block->vMax : vMin;
+    decelerating = false;
+    blockTail = (blockTail + 1) & (MOTION_QUEUE_SIZE - 1);
+    stats.blocksStarted++;
+
+    MotionPlan();
+}
+
+/**
+ * Plan the next segment of the current block
+ */
+static void MotionNextSegment(StepperSegment *segment)
+{
+    uint32_t steps = (uint32_t)(velocity * MOTION_SEGMENT_TIME_S);
+    uint32_t interval = (uint32_t)((float)STEPPER_TICK_HZ / velocity + 0.5f);
+
+    if (steps < 1)
+        steps = 1;
+    if (steps > remaining)
+        steps = remaining;
+    if (steps > 0xFFFF)
+        steps = 0xFFFF;
+
+    if (interval < (STEPPER_TICK_HZ / STEPPER_MAX_RATE))
+        interval = STEPPER_TICK_HZ / STEPPER_MAX_RATE;
+    if (interval > STEPPER_MAX_INTERVAL)
+        interval = STEPPER_MAX_INTERVAL;
+
+    remaining -= steps;
+    segment->interval = (moveDir < 0) ? -(int32_t)interval : (int32_t)interval;
+    segment->steps = (uint16_t)steps;
+    segment->flags = ((remaining == 0) && (MotionQueueDepth() == 0)) ? STEPPER_SEGMENT_LAST : 0;
+
+    if (!decelerating && ((float)remaining <= MotionStopDistance()))
+        decelerating = true;
+
+    MotionAdvance((float)(steps * interval) / (float)STEPPER_TICK_HZ);
+
+    if ((remaining == 0) && (MotionQueueDepth() > 0))
+        MotionNextBlock();
+}
+
+/**
+ * Queue segments until the stepper queue is full or the run is planned
+ */
+static void MotionFill(void)
+{
+    StepperSegment segment;
+
+    while (active && (StepperQueueFree() > 0))
+    {
+        MotionNextSegment(&segment);
+        StepperQueuePush(&segment);
+        if (segment.flags & STEPPER_SEGMENT_LAST) {
+            active = false;
+            stats.drained++;
+        }
+    }
+}
+
+/**
+ * Start stepping out the waiting blocks from rest
+ */
+static int32_t MotionStartRun(void)
+{
+    const MotionParams *params = &appConfig.motion;
+
+    if (!StepperIsEnabled() || StepperIsRunning())
+        return SCH_ERR_OTHER;
+
+    profile = params->profile;
+    vMin = (float)((params->startVelocity < params->maxVelocity) ? params->startVelocity : params->maxVelocity);
+    aMax = (float)params->acceleration;
+    aPlan = (profile == MOTION_PROFILE_TRAPEZOID) ? aMax : (0.5f * aMax);
+    jMax = (float)params->jerk;
+
+    velocity = vMin;
+    acceleration = 0.0f;
+    active = false;
+    MotionNextBlock();
+    active = true;
+
+    MotionFill();
+
+    StepperSetDma(appConfig.stepperDma != 0);
+    if (StepperQueueStart() != SCH_OK) {
+        active = false;
+        blockTail = blockHead;
+        return SCH_ERR_OTHER;
+    }
+
+    return SCH_OK;
+}
+
+/**
+ * @brief Queue a relative move behind the moves already queued.
+ *
+ * @param steps - signed distance in steps
+ * @param maxVelocity - block velocity in steps/s, 0 = configured velocity
+ * @return SCH_OK, SCH_ERR_INVALID_PARAM on a velocity outside the step rate
+ *         range, SCH_ERR_OTHER when the queue is full or the driver is disabled
+ */
+int32_t MotionQueue(int32_t steps, int32_t maxVelocity)
+{
+    MotionBlock *block;
+    uint8_t next = (blockHead + 1) & (MOTION_QUEUE_SIZE - 1);
+
+    if ((maxVelocity < 0) || (maxVelocity > STEPPER_MAX_RATE))
+        return SCH_ERR_INVALID_PARAM;
+    if ((next == blockTail) || !StepperIsEnabled())
+        return SCH_ERR_OTHER;
+    if (!active && StepperIsRunning() && !StepperIsQueueMode())
+        return SCH_ERR_OTHER;
+    if (steps == 0)
+        return SCH_OK;
+
+    block = &blocks[blockHead];
+    block->steps = steps;
+    block->vMax = (float)((maxVelocity != 0) ? maxVelocity : appConfig.motion.maxVelocity);
+    block->entry = 0.0f;
+    blockHead = next;
+    stats.blocksQueued++;
+
+    if (active)
+        MotionPlan();
+    else if (!StepperIsRunning())
+        return MotionStartRun();
+
+    // Previous run still stepping out its last segments: started by MotionPoll()
+
+    return SCH_OK;
+}
+
+/**
+ * @brief Start a relative move with the configured profile.
+ *
+ * @param steps - signed distance in steps
+ * @return SCH_OK, SCH_ERR_OTHER when a move is running or the driver is disabled
+ */
+int32_t MotionMove(int32_t steps)
+{
+    if (MotionIsBusy() || StepperIsRunning() || !StepperIsEnabled())
+        return SCH_ERR_OTHER;
+
+    return MotionQueue(steps, 0);
+}
+
+/**
+ * Decelerate to a stop and drop the waiting blocks. Segments already
+ * queued are stepped out first.
+ */
+void MotionStop(void)
+{
+    float distance;
+
+    blockTail = blockHead;
+    if (!active)
+        return;
+
+    vEnd = vMin;
+    distance = ceilf(MotionStopDistance());
+    if ((float)remaining > distance)
+        remaining = (distance < 1.0f) ? 1 : (uint32_t)distance;
+    decelerating = true;
+}
+
+/**
+ * Keep the stepper segment queue filled. Called from the main loop.
+ */
+void MotionPoll(void)
+{
+    if (!active) {
+        // Blocks queued while the previous run was ending
+        if ((MotionQueueDepth() > 0) && !StepperIsRunning() && (MotionStartRun() != SCH_OK))
+            blockTail = blockHead;
+        return;
+    }
+
+    // Stepper stopped or disabled under the planner: the run is abandoned
+    if (!StepperIsEnabled() || !StepperIsRunning()) {
+        active = false;
+        blockTail = blockHead;
+        return;
+    }
+
+    MotionFill();
+}
+
+/**
+ * Move being planned or stepped out, or waiting in the queue
+ */
+bool MotionIsBusy(void)
+{
+    return active || (MotionQueueDepth() > 0) || (StepperIsRunning() && StepperIsQueueMode());
+}
+
+/**
+ * Queue state for host flow control
+ */
+void MotionGetStats(MotionStats *statsOut)
+{
+    *statsOut = stats;
+    statsOut->depth = MotionQueueDepth();
+    statsOut->free = (MOTION_QUEUE_SIZE - 1) - statsOut->depth;
+    statsOut->reserved = 0;
+    statsOut->underruns = StepperGetUnderruns();
+    statsOut->position = StepperGetPosition();
+}
@@ -0,0 +1,57 @@
+#ifndef _MOTION_H
+#define _MOTION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Velocity profiles
+ */
+#define MOTION_PROFILE_TRAPEZOID    0       // Constant acceleration
+#define MOTION_PROFILE_SCURVE       1       // Acceleration ramped with limited jerk
+
+#define MOTION_SEGMENT_TIME_S       0.001f  // Planned time per queued segment
+#define MOTION_QUEUE_SIZE           16      // Power of two, one slot stays free
+
+/**
+ * Default motion parameters (steps, s)
+ */
+#define MOTION_DEFAULT_MAX_VELOCITY     3200
+#define MOTION_DEFAULT_ACCELERATION     10000
+#define MOTION_DEFAULT_JERK             200000
+#define MOTION_DEFAULT_START_VELOCITY   100
+
+/**
+ * Motion parameters, part of the persistent configuration
+ */
+typedef struct {
+    int32_t maxVelocity;        // steps/s
+    int32_t acceleration;       // steps/s^2
+    int32_t jerk;               // steps/s^3, S-curve only
+    int32_t startVelocity;      // steps/s, moves start and end at this rate
+    uint8_t profile;            // MOTION_PROFILE_xxx
+    uint8_t reserved[3];
+} MotionParams;
+
+/**
+ * Block queue state, PKT_MOTION_STATUS
+ */
+typedef struct {
+    uint8_t  depth;             // Blocks waiting, not counting the one being stepped out
+    uint8_t  free;              // Blocks that can still be queued
+    uint16_t reserved;
+    uint32_t blocksQueued;
+    uint32_t blocksStarted;
+    uint32_t drained;           // Runs that ended because the queue ran empty
+    uint32_t underruns;         // Stepper segments not planned in time
+    int32_t  position;          // Step position
+} MotionStats;
+
+void MotionLoadDefaults(MotionParams *params);
+int32_t MotionQueue(int32_t steps, int32_t maxVelocity);
+int32_t MotionMove(int32_t steps);
+void MotionStop(void);
+void MotionPoll(void);
+bool MotionIsBusy(void);
+void MotionGetStats(MotionStats *statsOut);
+#endif
@@ -0,0 +1,112 @@
+/* Profiler.c
+ * Per stage cycle statistics for the PROF_START()/PROF_END() instrumentation.
+ *
+ * Durations are DWT->CYCCNT differences (64 cycles per microsecond, wraps
+ * after 67 s), so a stage preempted by an interrupt includes the time spent
+ * in the interrupt. Statistics are kept from boot or from the last reset and
+ * reported on request, one PKT_PROFILE per stage.
+ */
+
+#include "Profiler.h"
+#include "Protocol.h"
+#include "Link.h"
+
+#if PROFILER_ENABLED
+
+#include "Critical.h"
+#include <string.h>
+
+typedef struct {
+    uint32_t count;
+    uint32_t minCycles;
+    uint32_t maxCycles;
+    uint64_t sumCycles;
+    uint16_t histogram[PROFILER_HISTOGRAM_BINS];
+} ProfilerStats;
+
+static ProfilerStats stats[PROF_STAGES];
+
+/**
+ * Add one stage duration. Called from the event handlers.
+ */
+void ProfilerRecord(ProfilerStage stage, uint32_t cycles)
+{
+    ProfilerStats *s;
+    uint32_t bin;
+    uint32_t basepri;
+
+    if (stage >= PROF_STAGES)
+        return;
+
+    // log2 of the duration, 0 and 1 cycle both go to bin 0
+    bin = (cycles > 1) ? (31U - __CLZ(cycles)) : 0;
+    if (bin >= PROFILER_HISTOGRAM_BINS)
+        bin = PROFILER_HISTOGRAM_BINS - 1;
+
+    s = &stats[stage];
+    basepri = CriticalEnter();
+    if ((s->count == 0) || (cycles < s->minCycles))
+        s->minCycles = cycles;
+    if (cycles > s->maxCycles)
+        s->maxCycles = cycles;
+    s->sumCycles += cycles;
+    s->count++;
+    if (s->histogram[bin] != UINT16_MAX)
+        s->histogram[bin]++;
+    CriticalExit(basepri);
+}
+
+void ProfilerReset(void)
+{
+    uint32_t basepri = CriticalEnter();
+    memset(stats, 0, sizeof(stats));
+    CriticalExit(basepri);
+}
+
+/**
+ * @brief Send the statistics of all stages.
+ *
+ * @return SCH_OK, SCH_ERR_OTHER when a packet did not fit in the TX buffer
+ */
+int32_t ProfilerSend(void)
+{
+    ProfilerReport report;
+    uint32_t basepri;
+    int32_t status = SCH_OK;
+
+    for (uint8_t stage = 0; stage < PROF_STAGES; stage++) {
+        const ProfilerStats *s = &stats[stage];
+
+        memset(&report, 0, sizeof(report));
+        report.stage = stage;
+
+        basepri = CriticalEnter();
+        report.count = s->count;
+        report.minCycles = s->minCycles;
+        report.maxCycles = s->maxCycles;
+        report.avgCycles = (s->count != 0) ? (uint32_t)(s->sumCycles / s->count) : 0;
+        memcpy(report.histogram, s->histogram, sizeof(report.histogram));
+        CriticalExit(basepri);
+
+        if (!LinkSend(PKT_PROFILE, &report, sizeof(report)))
+            status = SCH_ERR_OTHER;
+    }
+
+    return status;
+}
+
+#else
+
+void ProfilerReset(void)
+{
+}
+
+/**
+ * Profiler compiled out
+ */
+int32_t ProfilerSend(void)
+{
+    return SCH_ERR_OTHER;
+}
+
+#endif
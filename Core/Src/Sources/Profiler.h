@@ -0,0 +1,67 @@
+#ifndef _PROFILER_H
+#define _PROFILER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Stage profiler on the DWT cycle counter. Enabled in the Debug build
+ * configuration, PROF_START()/PROF_END() compile to nothing otherwise.
+ */
+#ifndef PROFILER_ENABLED
+#ifdef DEBUG
+#define PROFILER_ENABLED            1
+#else
+#define PROFILER_ENABLED            0
+#endif
+#endif
+
+#define PROFILER_HISTOGRAM_BINS     16      // Bin n counts durations of 2^n .. 2^(n+1)-1 cycles, last bin open
+
+/**
+ * Profiled stages of the acquisition and output path
+ */
+typedef enum {
+    PROF_SAMPLE_EVENT = 0,      // Whole sample event handler
+    PROF_SPI_DATA1,             // Rate1/Acc1/Temp SPI transfers
+    PROF_SPI_DATA2,             // Rate2/Acc2/status SPI transfers
+    PROF_FRAME_CHECK,           // Frame CRC and error flag decode, per call
+    PROF_CONVERT,               // SCHConvertData()
+    PROF_CONTROL,               // Rate controller and calibration update
+    PROF_OUTPUT,                // Sample packet assembly and queueing
+    PROF_LINK_SEND,             // LinkSend(): CRC, copy and UART DMA start, all callers
+    PROF_STAGES
+} ProfilerStage;
+
+/**
+ * PKT_PROFILE payload, one packet per stage
+ */
+typedef struct {
+    uint8_t  stage;             // ProfilerStage
+    uint8_t  reserved[3];
+    uint32_t count;             // Recorded durations
+    uint32_t minCycles;
+    uint32_t maxCycles;
+    uint32_t avgCycles;
+    uint16_t histogram[PROFILER_HISTOGRAM_BINS];    // Saturating counts
+} ProfilerReport;
+
+#if PROFILER_ENABLED
+
+#include "main.h"
+
+#define PROF_START(stage)   uint32_t profStart_##stage = DWT->CYCCNT
+#define PROF_END(stage)     ProfilerRecord((stage), DWT->CYCCNT - profStart_##stage)
+
+void ProfilerRecord(ProfilerStage stage, uint32_t cycles);
+
+#else
+
+#define PROF_START(stage)   do { } while (0)
+#define PROF_END(stage)     do { } while (0)
+
+#endif
+
+void ProfilerReset(void);
+int32_t ProfilerSend(void);
+#endif
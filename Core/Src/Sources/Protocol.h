@@ -0,0 +1,265 @@
+#ifndef _PROTOCOL_H
+#define _PROTOCOL_H
+
+#include <stdint.h>
+#include "SCHsensor.h"
+#include "ConfigStore.h"
+
+/**
+ * Link frame format (USART1, both directions)
+ *
+ *   SYNC1 SYNC2 TYPE LEN PAYLOAD[LEN] CRC_L CRC_H
+ *
+ * CRC-16/CCITT (init 0xFFFF) is calculated over TYPE, LEN and PAYLOAD.
+ * All multi-byte fields are little-endian, floats are IEEE-754 single.
+ */
+#define LINK_SYNC1                  0xA5
+#define LINK_SYNC2                  0x5A
+#define LINK_HEADER_SIZE            4
+#define LINK_CRC_SIZE               2
+#define LINK_MAX_PAYLOAD            255
+
+/**
+ * Device -> host packet types
+ */
+#define PKT_SAMPLE                  0x01
+#define PKT_ACK                     0x02
+#define PKT_CONFIG                  0x03
+#define PKT_STATUS                  0x04
+#define PKT_HEALTH                  0x05
+#define PKT_MOTOR_FAULT             0x06    // StepperFault, sent once per latched driver fault
+#define PKT_CAL_POINT               0x07    // Rate table run completed
+#define PKT_CAL_RESULT              0x08    // Rate table fit, or failure
+#define PKT_MOTION_STATUS           0x09    // MotionStats, periodic while moving and on request
+#define PKT_PROFILE                 0x0A    // ProfilerReport, one per stage
+#define PKT_TRACE                   0x0B    // PktTrace, trace ring records
+#define PKT_SAMPLE_RATE             0x0C    // SampleRatePlan, answer to CMD_SAMPLE_RATE
+#define PKT_CAPTURE                 0x0D    // PktCapture, part of a frozen shock capture window
+#define PKT_CAPTURE_STATUS          0x0E    // PktCaptureStatus, answer to CMD_CAPTURE
+#define PKT_STATS                   0x0F    // PktStats, one per statistics window (STREAM_STATS)
+#define PKT_SPECTRUM                0x10    // PktSpectrum, averaged Acc1 spectrum (STREAM_SPECTRUM)
+#define PKT_ZERO_MOTION             0x11    // PktZeroMotion, once a second and on still/moving changes
+#define PKT_TILT                    0x12    // PktTilt, pitch and roll per averaging period (STREAM_TILT)
+#define PKT_ALLAN                   0x13    // PktAllan, Allan deviation of one channel, answer to CMD_ALLAN
+
+/**
+ * Host -> device commands. Every command is answered with PKT_ACK
+ * (status = SCH_OK or SCH_ERR_xxx), commands that return data answer
+ * with their data packet instead.
+ */
+#define CMD_GET_CONFIG              0x80
+#define CMD_SET_PARAM               0x81
+#define CMD_SET_CALIBRATION         0x82
+#define CMD_SAVE_CONFIG             0x83    // ACK detail = record sequence; stalls acquisition 20-50 ms, see below
+#define CMD_LOAD_DEFAULTS           0x84
+#define CMD_SYSTEM_RESET            0x85
+#define CMD_MOTOR_ENABLE            0x86    // uint8_t enable
+#define CMD_MOTOR_SET_RATE          0x87    // int32_t steps/s, signed, 0 = stop
+#define CMD_MOTION_MOVE             0x88    // int32_t relative steps, profiled move
+#define CMD_MOTION_STOP             0x89    // Decelerate to a stop
+#define CMD_CONTROLLER_ENABLE       0x8A    // uint8_t enable, closed rate loop on the stepper
+#define CMD_HOME                    0x8B    // uint8_t 1 = start homing, 0 = abort
+#define CMD_MOTOR_REARM             0x8C    // Clear a latched driver fault and enable the driver
+#define CMD_CALIBRATE               0x8D    // uint8_t 1 = start rate table calibration, 0 = abort
+#define CMD_MOTION_QUEUE            0x8E    // CmdMotionQueue, ACK detail = free queue slots
+#define CMD_MOTION_STATUS           0x8F    // Answered with PKT_MOTION_STATUS
+#define CMD_PROFILE                 0x90    // uint8_t 0 = send PKT_PROFILE per stage, 1 = clear (Debug build only)
+#define CMD_TRACE                   0x91    // CmdTrace, stream / dump / restart the event trace
+#define CMD_SAMPLE_RATE             0x92    // CmdSampleRate, ACK detail = SAMPLE_RATE_xxx, then PKT_SAMPLE_RATE
+#define CMD_CAPTURE                 0x93    // CmdCapture, ACK detail = window length in samples, then PKT_CAPTURE_STATUS
+#define CMD_ALLAN                   0x94    // CmdAllan, ACK detail = levels, report mode then sends PKT_ALLAN per channel
+
+/**
+ * CMD_SAVE_CONFIG (and the save after a rate table calibration) erases and
+ * programs a flash page. Instruction fetches stall meanwhile, interrupts
+ * included, so 20-50 ms of samples are not read. The ACK is sent after
+ * the save; the gap shows as a jump in PktSample sampleCounter and is
+ * counted in PktHealth missedSamples.
+ */
+
+/**
+ * Configuration parameters for CMD_SET_PARAM. Sensor settings take effect
+ * on the next sensor initialization, link settings on the next boot and
+ * motion settings on the next move. Controller settings take effect
+ * immediately.
+ */
+#define PARAM_FILTER_RATE           0x01
+#define PARAM_FILTER_ACC12          0x02
+#define PARAM_FILTER_ACC3           0x03
+#define PARAM_SENS_RATE1            0x04
+#define PARAM_SENS_RATE2            0x05
+#define PARAM_SENS_ACC1             0x06
+#define PARAM_SENS_ACC2             0x07
+#define PARAM_SENS_ACC3             0x08
+#define PARAM_DEC_RATE2             0x09
+#define PARAM_DEC_ACC2              0x0A
+#define PARAM_ENABLE_DRY            0x0B
+#define PARAM_BAUD_RATE             0x10
+#define PARAM_OUTPUT_DIVIDER        0x11
+#define PARAM_STREAMS               0x12
+#define PARAM_MOTION_PROFILE        0x20    // MOTION_PROFILE_xxx
+#define PARAM_MOTION_MAX_VELOCITY   0x21    // steps/s
+#define PARAM_MOTION_ACCELERATION   0x22    // steps/s^2
+#define PARAM_MOTION_JERK           0x23    // steps/s^3
+#define PARAM_MOTION_START_VELOCITY 0x24    // steps/s
+#define PARAM_STEPPER_DMA           0x25    // 1 = feed planned moves to TIM4 through DMA
+#define PARAM_HOME_DIRECTION        0x28    // Side of the limit switch, -1 or +1
+#define PARAM_HOME_FAST_VELOCITY    0x29    // steps/s
+#define PARAM_HOME_SLOW_VELOCITY    0x2A    // steps/s
+#define PARAM_HOME_BACKOFF          0x2B    // steps
+#define PARAM_HOME_OFFSET           0x2C    // Position assigned to the switch point
+#define PARAM_HOME_TRAVEL           0x2D    // steps, longest approach before homing fails
+#define PARAM_CTRL_KP               0x30    // Q16 steps/s per dps
+#define PARAM_CTRL_KI               0x31    // Q16 steps/s per dps*s
+#define PARAM_CTRL_KD               0x32    // Q16 steps/s per dps/s
+#define PARAM_CTRL_KFF              0x33    // Q16 steps/s per dps of setpoint
+#define PARAM_CTRL_SETPOINT         0x34    // mdps
+#define PARAM_CTRL_AXIS             0x35    // Rate1 AXIS_X/Y/Z
+#define PARAM_CTRL_DIVIDER          0x36    // Loop on every Nth acquired sample, 1..255
+#define PARAM_CAL_STEPS_PER_REV     0x38    // Steps per turntable revolution
+#define PARAM_CAL_MAX_RATE          0x39    // Highest table rate, dps
+#define PARAM_CAL_WINDOW_STEPS      0x3A    // Steps integrated per run
+#define PARAM_CAL_POINTS            0x3B    // Rates per direction, 1..CALIBRATION_MAX_POINTS
+#define PARAM_CAL_AXIS              0x3C    // Rate1 axis on the motor shaft
+#define PARAM_STATS_SAMPLES         0x40    // Statistics window, samples, 0 = no sample limit
+#define PARAM_STATS_PERIOD_MS       0x41    // Statistics window, ms, 0 = no time limit
+#define PARAM_FFT_AXIS              0x44    // Acc1 axis of the spectrum, AXIS_X/Y/Z
+#define PARAM_FFT_AVERAGES          0x45    // Spectra averaged per PKT_SPECTRUM, 1..FFT_MAX_AVERAGES
+#define PARAM_ZMOTION_MODE          0x48    // ZERO_MOTION_OFF/DETECT/TRACK
+#define PARAM_ZMOTION_WINDOW        0x49    // Samples per detector window, 16..4096
+#define PARAM_ZMOTION_STILL_WINDOWS 0x4A    // Consecutive quiet windows before still, 1..255
+#define PARAM_ZMOTION_BIAS_SHIFT    0x4B    // Bias update weight 2^-n per still window, 0..15
+#define PARAM_ZMOTION_RATE_NOISE    0x4C    // Rate1 norm standard deviation limit, mdps
+#define PARAM_ZMOTION_ACC_NOISE     0x4D    // Acc1 norm standard deviation limit, mm/s2
+#define PARAM_TILT_SOURCE           0x50    // TILT_SOURCE_ACC1/ACC3
+#define PARAM_TILT_PERIOD_MS        0x51    // Averaging window and PKT_TILT period, ms, 10..60000
+
+/**
+ * Stream enable bits (PARAM_STREAMS). Optional sections are appended to
+ * PktSample in bit order, the host derives the layout from PARAM_STREAMS.
+ * STREAM_STATS, STREAM_SPECTRUM and STREAM_TILT are packets of their own,
+ * independent of STREAM_SAMPLES.
+ */
+#define STREAM_SAMPLES              0x00000001UL
+#define STREAM_CONTROLLER           0x00000002UL    // ControllerTelemetry after PktSample
+#define STREAM_STEPPER              0x00000004UL    // StepperTag latched at the SPI acquisition
+#define STREAM_STATS                0x00000008UL    // PKT_STATS per statistics window
+#define STREAM_SPECTRUM             0x00000010UL    // PKT_SPECTRUM per averaged spectrum
+#define STREAM_TILT                 0x00000020UL    // PKT_TILT per averaging period
+
+/**
+ * Sensor start modes (PktStatus.startMode)
+ */
+#define START_MODE_COLD             0       // Full reset and startup sequence
+#define START_MODE_WARM             1       // Sensor configuration verified after MCU-only reset
+
+/**
+ * Packet payloads. Fields are ordered so that no padding is inserted.
+ */
+typedef struct {
+    uint32_t sampleCounter;     // Sample tick count, gaps mean dropped packets or missed samples
+    SCHResult result;
+    uint16_t health;            // SCH_HEALTH_xxx from interleaved status reads, set = not OK
+    uint16_t quality;           // SCH_QUALITY_xxx of this sample, set = channel value not valid
+} PktSample;
+
+typedef struct {
+    uint8_t  command;           // Command being answered
+    int8_t   status;            // SCH_OK or SCH_ERR_xxx
+    uint16_t detail;            // Command specific detail, e.g. rejected parameter id
+} PktAck;
+
+typedef struct {
+    uint32_t uptimeMs;
+    uint32_t firstValidSampleMs;    // Boot to first error free sample, 0 = not yet
+    uint8_t  sensorState;           // SCHInitState, SCH_INIT_READY when streaming
+    uint8_t  initAttempt;           // Attempt within the current startup sequence
+    uint16_t initFailures;          // Failed startup sequences since boot
+    uint8_t  startMode;             // START_MODE_xxx of the last sensor start
+    uint8_t  homingState;           // HomingState
+    uint16_t recoveries;            // Sensor restarts after confirmed status faults
+} PktStatus;
+
+typedef struct {
+    SCHQualityWindow window;        // Frame error counters over the last window samples
+    uint16_t faults;                // SCH_HEALTH_xxx, last status read not OK
+    uint16_t confirmed;             // SCH_HEALTH_xxx, not OK on consecutive reads
+    uint16_t cpuLoad;               // Time not sleeping in the scheduler, per mille
+    uint32_t statusReads;           // Interleaved status register reads since sensor start
+    uint32_t txDropped;             // Link frames dropped on full TX buffer
+    uint32_t rxCrcErrors;           // Host frames with CRC mismatch
+    uint16_t tickLatencyMax;        // TIM2 update to interrupt entry, us, max over the window
+    uint16_t tickLatencyPeak;       // Same, max since boot
+    uint16_t sampleLatencyMax;      // TIM2 update to sample handler start, us, max over the window
+    uint16_t sampleLatencyPeak;     // Same, max since boot
+    uint16_t readLatencyMax;        // TIM2 update to the end of the SPI sequence, us, max over the window
+    uint16_t readLatencyPeak;       // Same, max since boot
+    uint32_t missedSamples;         // Sample ticks passed without a read since boot (handler or flash stall)
+} PktHealth;
+
+typedef struct {
+    uint8_t  run;               // Run index, positive rates first
+    uint8_t  runs;
+    uint8_t  axis;
+    uint8_t  badSamples;        // Invalid gyro frames replaced in this run
+    float    reference;         // Table rate from steps and samples, dps
+    float    measured;          // Mean raw gyro output, LSB
+    uint32_t samples;
+    int32_t  steps;             // Steps in the integration window, signed
+} PktCalPoint;
+
+typedef struct {
+    uint8_t  state;             // CalibrationState, DONE or FAILED
+    uint8_t  axis;
+    uint8_t  runs;              // Runs fitted (completed on failure)
+    uint8_t  saved;             // Result written to flash
+    float    scale;             // LSB / dps, signed by mounting direction
+    int32_t  bias;              // LSB
+    float    residual[CALIBRATION_MAX_RUNS];    // Fit residual per run, dps
+} PktCalResult;
+
+typedef struct {
+    uint16_t  version;          // CONFIG_VERSION, host must match the AppConfig layout
+    uint16_t  size;             // sizeof(AppConfig)
+    uint32_t  sequence;         // Flash record sequence, 0 = defaults
+    AppConfig config;
+} PktConfig;
+
+typedef struct {
+    int32_t  steps;             // Signed relative distance
+    int32_t  velocity;          // Block velocity, steps/s, 0 = PARAM_MOTION_MAX_VELOCITY
+} CmdMotionQueue;
+
+typedef struct {
+    uint8_t  param;             // PARAM_xxx
+    uint8_t  reserved[3];
+    int32_t  value;
+} CmdSetParam;
+
+typedef struct {
+    uint8_t  mode;              // TRACE_MODE_xxx
+    uint8_t  reserved[3];
+    uint32_t mask;              // Recorded events, 1 << TraceEvent, 0 = unchanged
+} CmdTrace;
+
+typedef struct {
+    uint32_t rate;              // Hz, 0 = only report the active plan
+    uint8_t  clamp;             // 1 = apply the highest rate within budget instead of rejecting
+    uint8_t  reserved[3];
+} CmdSampleRate;
+
+typedef struct {
+    uint8_t  mode;              // CAPTURE_MODE_xxx
+    uint8_t  triggers;          // CAPTURE_TRIG_xxx
+    uint16_t preTrigger;        // Samples kept before the trigger sample
+    int32_t  accThreshold;      // Acc3 magnitude, mm/s2, gravity included
+    int32_t  rateThreshold;     // Rate1 magnitude, mdps
+} CmdCapture;
+
+typedef struct {
+    uint8_t  mode;              // ALLAN_MODE_xxx
+    uint8_t  baseShift;         // Start: level 0 cluster of 2^baseShift samples, 0..ALLAN_MAX_BASE_SHIFT
+    uint8_t  reserved[2];
+} CmdAllan;
+
+#endif
@@ -4,18 +4,87 @@
  */
 
 #include "SCHsensor.h"
+#include "Profiler.h"
+#include "Trace.h"
+#include "Critical.h"
 #include "main.h"
 #include <stdio.h>
 #include <stdbool.h>
 #include "spi.h"
-#include "tim.h"
 #include <stdint.h>
+#include <string.h>
 
 /**
  * Internal function prototypes (static where appropriate)
  */
 static uint8_t Crc8(uint64_t spiFrame);
 static uint8_t Crc3(uint32_t spiFrame);
+static void SCHUpdateGains(void);
+static void SCHUpdateBias(void);
+
+/**
+ * Output scaling. Prepared in RAM by SCHInitStart() and SCHSetCalibration() so the
+ * sample path only subtracts the bias and multiplies.
+ */
+static SCHSensitivity activeSensitivity = {
+    SENSITIVITY_RATE1, SENSITIVITY_RATE2, SENSITIVITY_ACC1, SENSITIVITY_ACC2, SENSITIVITY_ACC3
+};
+static SCHCalibration activeCalibration;
+static float rate1Gain[3] = {
+    1.0f / (SENSITIVITY_RATE1 * AVG_FACTOR), 1.0f / (SENSITIVITY_RATE1 * AVG_FACTOR), 1.0f / (SENSITIVITY_RATE1 * AVG_FACTOR)
+};
+static float acc1Gain[3] = {
+    1.0f / (SENSITIVITY_ACC1 * AVG_FACTOR), 1.0f / (SENSITIVITY_ACC1 * AVG_FACTOR), 1.0f / (SENSITIVITY_ACC1 * AVG_FACTOR)
+};
+static float rate2Gain = 1.0f / (SENSITIVITY_RATE2 * AVG_FACTOR);
+static float acc2Gain  = 1.0f / (SENSITIVITY_ACC2 * AVG_FACTOR);
+static float acc3Gain  = 1.0f / (SENSITIVITY_ACC3 * AVG_FACTOR);
+
+/**
+ * Rate1 bias in effect: the calibration bias, or the tracked bias while
+ * SCHSetRate1BiasTrack() is active. Q8 LSB, and as float for SCHConvertData().
+ */
+static bool rate1BiasTracking = false;
+static int32_t rate1TrackedBias[3];
+static int32_t rate1BiasQ8[3];
+static float rate1Offset[3];
+
+/**
+ * Interleaved status supervision. One status register request is appended to
+ * every sample; its response arrives with the first frame of the next sample.
+ */
+static const uint64_t statusRequests[SCH_STATUS_REGISTERS] = {
+    REQ_READ_STAT_SUM, REQ_READ_STAT_SUM_SAT, REQ_READ_STAT_COM, REQ_READ_STAT_RATE_COM,
+    REQ_READ_STAT_RATE_X, REQ_READ_STAT_RATE_Y, REQ_READ_STAT_RATE_Z,
+    REQ_READ_STAT_ACC_X, REQ_READ_STAT_ACC_Y, REQ_READ_STAT_ACC_Z
+};
+static const uint16_t statusHealthBits[SCH_STATUS_REGISTERS] = {
+    SCH_HEALTH_SUMMARY, SCH_HEALTH_SATURATION, SCH_HEALTH_COMMON, SCH_HEALTH_RATE_COMMON,
+    SCH_HEALTH_RATE_X, SCH_HEALTH_RATE_Y, SCH_HEALTH_RATE_Z,
+    SCH_HEALTH_ACC_X, SCH_HEALTH_ACC_Y, SCH_HEALTH_ACC_Z
+};
+static uint64_t lastRequest = 0;            // Request whose response arrives with the next frame
+static uint8_t statusIndex = 0;
+static volatile uint8_t readAcc3 = 0;          // SCH_ACC3_xxx users of the Acc3 frames in SCHGetData2()
+static uint8_t statusBadReads[SCH_STATUS_REGISTERS];
+static SCHHealth health;
+
+/**
+ * Per-frame quality decoding and sliding window error counters
+ */
+static const uint16_t data1QualityBits[7] = {
+    SCH_QUALITY_RATE1_X, SCH_QUALITY_RATE1_Y, SCH_QUALITY_RATE1_Z,
+    SCH_QUALITY_ACC1_X, SCH_QUALITY_ACC1_Y, SCH_QUALITY_ACC1_Z, SCH_QUALITY_TEMP
+};
+static const uint16_t data2QualityBits[6] = {
+    SCH_QUALITY_RATE2_X, SCH_QUALITY_RATE2_Y, SCH_QUALITY_RATE2_Z,
+    SCH_QUALITY_ACC2_X, SCH_QUALITY_ACC2_Y, SCH_QUALITY_ACC2_Z
+};
+static const uint16_t data3QualityBits[3] = {
+    SCH_QUALITY_ACC3_X, SCH_QUALITY_ACC3_Y, SCH_QUALITY_ACC3_Z
+};
+static SCHQualityWindow qualityBlocks[SCH_QUALITY_WINDOW_BLOCKS];
+static uint8_t qualityBlock = 0;
 
 /**
  * GPIO helpers (PascalCase names)
@@ -75,6 +144,7 @@ uint64_t SCHSpi48SendRequest(uint64_t request)
   //  HAL_Delay(5);
     SCHCsHigh();
    // HAL_Delay(5);
+    lastRequest = request;
 
     // Create receivedData qword from received rx buffer (MISO data).
     for (index = 0; index < size; index++)
@@ -85,15 +155,6 @@ uint64_t SCHSpi48SendRequest(uint64_t request)
     return receivedData;
 }
 
-void HwTimerSetFreq(uint32_t freq)
-{
-    // Set sample timer frequency. MCU APB1-bus frequency that clocks
-    // the timer TIM2 is set to 1 MHz in HW.c function TIM_Init().
-    htim2.Init.Period = 1000000 / freq;
-    if (HAL_TIM_Base_Init(&htim2) != HAL_OK)
-        while (1) {}
-}
-
 void SCHSendSpiReset(void)
 {
     SCHSpi48SendRequest(REQ_SOFTRESET);
@@ -227,13 +288,59 @@ int SCHSetFilters(uint32_t freqRate12, uint32_t freqAcc12, uint32_t freqAcc3)
     return SCH_OK;
 }
 
+/**
+ * RATE_CTRL data field: Rate_XYZ1 sensitivity, Rate_XYZ2 sensitivity and
+ * Rate_XYZ2 decimation for all three axes.
+ */
+static uint32_t SCHRateCtrlField(uint16_t sensRate1, uint16_t sensRate2, uint16_t decRate2)
+{
+    uint32_t dataField;
+    uint32_t bitField;
+
+    dataField = SCHConvertRateSensToBitfield(sensRate1);
+    dataField <<= 3;
+    bitField = SCHConvertRateSensToBitfield(sensRate2);
+    dataField |= bitField;
+    dataField <<= 3;
+    bitField = SCHConvertDecimationToBitfield(decRate2);
+    dataField |= bitField;
+    dataField <<= 3;
+    dataField |= bitField;
+    dataField <<= 3;
+    dataField |= bitField;
+
+    return dataField;
+}
+
+/**
+ * ACC12_CTRL data field, same layout as RATE_CTRL
+ */
+static uint32_t SCHAcc12CtrlField(uint16_t sensAcc1, uint16_t sensAcc2, uint16_t decAcc2)
+{
+    uint32_t dataField;
+    uint32_t bitField;
+
+    dataField = SCHConvertAccSensToBitfield(sensAcc1);
+    dataField <<= 3;
+    bitField = SCHConvertAccSensToBitfield(sensAcc2);
+    dataField |= bitField;
+    dataField <<= 3;
+    bitField = SCHConvertDecimationToBitfield(decAcc2);
+    dataField |= bitField;
+    dataField <<= 3;
+    dataField |= bitField;
+    dataField <<= 3;
+    dataField |= bitField;
+
+    return dataField;
+}
+
 /**
  * Set rate sensitivities and decimation
  */
 int SCHSetRateSensDec(uint16_t sensRate1, uint16_t sensRate2, uint16_t decRate2)
 {
     uint32_t dataField;
-    uint32_t bitField;
     uint64_t requestFrameRateCtrl;
     uint64_t responseFrameRateCtrl;
     uint8_t crcValue;
@@ -251,17 +358,7 @@ int SCHSetRateSensDec(uint16_t sensRate1, uint16_t sensRate2, uint16_t decRate2)
     // Set sensitivities for Rate_XYZ1 (interpolated) and Rate_XYZ2 (decimated) outputs.
     // Also set decimation for Rate_XYZ2.
     requestFrameRateCtrl = REQ_SET_RATE_CTRL;
-    dataField = SCHConvertRateSensToBitfield(sensRate1);
-    dataField <<= 3;
-    bitField = SCHConvertRateSensToBitfield(sensRate2);
-    dataField |= bitField;
-    dataField <<= 3;
-    bitField = SCHConvertDecimationToBitfield(decRate2);
-    dataField |= bitField;
-    dataField <<= 3;
-    dataField |= bitField;
-    dataField <<= 3;
-    dataField |= bitField;
+    dataField = SCHRateCtrlField(sensRate1, sensRate2, decRate2);
 
     requestFrameRateCtrl |= dataField;
     requestFrameRateCtrl <<= 8;
@@ -329,7 +426,6 @@ int SCHGetRateSensDec(uint16_t *sensRate1, uint16_t *sensRate2, uint16_t *decRat
 int SCHSetAccSensDec(uint16_t sensAcc1, uint16_t sensAcc2, uint16_t sensAcc3, uint16_t decAcc2)
 {
     uint32_t dataField;
-    uint32_t bitField;
     uint64_t requestFrameAcc12Ctrl;
     uint64_t responseFrameAcc12Ctrl;
     uint64_t requestFrameAcc3Ctrl;
@@ -352,17 +448,7 @@ int SCHSetAccSensDec(uint16_t sensAcc1, uint16_t sensAcc2, uint16_t sensAcc3, ui
     // Set sensitivities for Acc_XYZ1 (interpolated) and Acc_XYZ2 (decimated) outputs.
     // Also set decimation for Acc_XYZ2.
     requestFrameAcc12Ctrl = REQ_SET_ACC12_CTRL;
-    dataField = SCHConvertAccSensToBitfield(sensAcc1);
-    dataField <<= 3;
-    bitField = SCHConvertAccSensToBitfield(sensAcc2);
-    dataField |= bitField;
-    dataField <<= 3;
-    bitField = SCHConvertDecimationToBitfield(decAcc2);
-    dataField |= bitField;
-    dataField <<= 3;
-    dataField |= bitField;
-    dataField <<= 3;
-    dataField |= bitField;
+    dataField = SCHAcc12CtrlField(sensAcc1, sensAcc2, decAcc2);
 
     requestFrameAcc12Ctrl |= dataField;
     requestFrameAcc12Ctrl <<= 8;
@@ -825,71 +911,376 @@ bool SCHCheckCrc3(uint32_t spiFrame)
 }
 
 /**
- * Initialize sensor (keeps original logic)
+ * Non-blocking initialization state machine. The startup sequence specified
+ * in section "5 Component Operation, Reset and Power Up" in the data sheet
+ * is split at its waits; SCHInitPoll() advances it once the wait has expired.
  */
-int32_t SCHInit(SCHFilter sFilter, SCHSensitivity sSensitivity, SCHDecimation sDecimation, bool enableDry)
+static SCHInitState initState = SCH_INIT_IDLE;
+static uint32_t initDeadline;
+static uint8_t initAttempt;
+static SCHFilter initFilter;
+static SCHSensitivity initSensitivity;
+static SCHDecimation initDecimation;
+static bool initEnableDry;
+
+static void SCHInitWait(SCHInitState nextState, uint32_t waitMs)
+{
+    // +1 so that a partially elapsed SysTick period never shortens the wait.
+    initDeadline = HAL_GetTick() + waitMs + 1;
+    initState = nextState;
+}
+
+/**
+ * Start sensor initialization in the background
+ */
+void SCHInitStart(SCHFilter sFilter, SCHSensitivity sSensitivity, SCHDecimation sDecimation, bool enableDry)
+{
+    initFilter = sFilter;
+    initSensitivity = sSensitivity;
+    initDecimation = sDecimation;
+    initEnableDry = enableDry;
+    initAttempt = 0;
+
+    activeSensitivity = sSensitivity;
+    SCHUpdateGains();
+    SCHResetHealth();
+
+    // Reset sensor, EXTRESN is released when the reset wait expires.
+    SCHExtresnLow();
+    SCHInitWait(SCH_INIT_RESET, 2);
+}
+
+/**
+ * @brief Advance the initialization state machine. Call periodically (sample timer tick).
+ *
+ * @return current state, SCH_INIT_READY when the sensor can be read
+ */
+SCHInitState SCHInitPoll(void)
 {
-    int ret = SCH_OK;
-    uint8_t startupAttempt = 0;
-    bool sch1status = false;
     SCHStatus sch1statusAll;
 
-    // SCH1 startup sequence specified in section "5 Component Operation,
-    // Reset and Power Up" in the data sheet.
+    if ((initState == SCH_INIT_IDLE) || (initState == SCH_INIT_READY) || (initState == SCH_INIT_FAILED))
+        return initState;
+
+    if ((int32_t)(HAL_GetTick() - initDeadline) < 0)
+        return initState;
 
-    SCHReset(); // Reset sensor
+    switch (initState)
+    {
+        case SCH_INIT_RESET:
+            SCHExtresnHigh();
+            // Wait 32 ms for the non-volatile memory (NVM) Read
+            SCHInitWait(SCH_INIT_NVM_READ, 32);
+            break;
 
-    for (startupAttempt = 0; startupAttempt < 2; startupAttempt++) {
+        case SCH_INIT_NVM_READ:
+            // Set user controls
+            SCHSetFilters(initFilter.rate, initFilter.acc, initFilter.acc3);
+            SCHSetRateSensDec(initSensitivity.rate1, initSensitivity.rate2, initDecimation.rate2);
+            SCHSetAccSensDec(initSensitivity.acc1, initSensitivity.acc2, initSensitivity.acc3, initDecimation.acc2);
+            SCHSetDry(0, initEnableDry);   // 0 = DRY active high
 
-        // Wait 32 ms for the non-volatile memory (NVM) Read
-        HAL_Delay(32);
+            // Write EN_SENSOR = 1 and wait 215 ms
+            SCHEnableMeas(true, false);
+            SCHInitWait(SCH_INIT_STARTUP, 215);
+            break;
 
-        // Set user controls
-        SCHSetFilters(sFilter.rate, sFilter.acc, sFilter.acc3);
-        SCHSetRateSensDec(sSensitivity.rate1, sSensitivity.rate2, sDecimation.rate2);
-        SCHSetAccSensDec(sSensitivity.acc1, sSensitivity.acc2, sSensitivity.acc3, sDecimation.acc2);
-        if (enableDry)
-            SCHSetDry(0, true);   // 0 = DRY active high
-        else
-            SCHSetDry(0, false);
+        case SCH_INIT_STARTUP:
+            // Read all status registers once. No critization
+            SCHGetStatus(&sch1statusAll);
 
-        // Write EN_SENSOR = 1
-        SCHEnableMeas(true, false);
+            // Write EOI = 1 (End of Initialization command) and wait 3 ms
+            SCHEnableMeas(true, true);
+            SCHInitWait(SCH_INIT_EOI, 3);
+            break;
 
-        // Wait 215 ms
-        HAL_Delay(215);
+        case SCH_INIT_EOI:
+            // Read all status registers twice.
+            SCHGetStatus(&sch1statusAll);
+            SCHGetStatus(&sch1statusAll);
+
+            // Check that all status registers have OK status.
+            if (SCHVerifyStatus(&sch1statusAll)) {
+                initState = SCH_INIT_READY;
+            }
+            else if (++initAttempt < SCH_INIT_ATTEMPTS) {
+                // Sensor failed, reset and retry.
+                SCHExtresnLow();
+                SCHInitWait(SCH_INIT_RESET, 2);
+            }
+            else {
+                initState = SCH_INIT_FAILED;
+            }
+            break;
 
-        // Read all status registers once. No critization
-        SCHGetStatus(&sch1statusAll);
+        default:
+            initState = SCH_INIT_FAILED;
+            break;
+    }
 
-        // Write EOI = 1 (End of Initialization command)
-        SCHEnableMeas(true, true);
+    return initState;
+}
 
-        // b 3 ms
-        HAL_Delay(3);
+SCHInitState SCHGetInitState(void)
+{
+    return initState;
+}
 
-        // Read all status registers twice.
-        SCHGetStatus(&sch1statusAll);
+uint8_t SCHGetInitAttempt(void)
+{
+    return initAttempt;
+}
+
+/**
+ * @brief Resume a sensor that kept running through an MCU-only reset.
+ *
+ * Reads back all user control registers and the status registers and
+ * compares them to the requested configuration. Takes well under a
+ * millisecond; on a match the sensor is marked ready without a reset.
+ *
+ * @return true when the sensor was resumed, false when a full
+ *         SCHInitStart() is needed
+ */
+bool SCHWarmStart(SCHFilter sFilter, SCHSensitivity sSensitivity, SCHDecimation sDecimation, bool enableDry)
+{
+    const uint64_t requests[] = {
+        REQ_READ_FILT_RATE, REQ_READ_FILT_ACC12, REQ_READ_FILT_ACC3,
+        REQ_READ_RATE_CTRL, REQ_READ_ACC12_CTRL, REQ_READ_ACC3_CTRL,
+        REQ_READ_USER_IF_CTRL, REQ_READ_MODE_CTRL
+    };
+    const uint32_t expected[] = {
+        SCHConvertFilterToBitfield(sFilter.rate),
+        SCHConvertFilterToBitfield(sFilter.acc),
+        SCHConvertFilterToBitfield(sFilter.acc3),
+        SCHRateCtrlField(sSensitivity.rate1, sSensitivity.rate2, sDecimation.rate2),
+        SCHAcc12CtrlField(sSensitivity.acc1, sSensitivity.acc2, sDecimation.acc2),
+        SCHConvertAccSensToBitfield(sSensitivity.acc3),
+        enableDry ? 0x20 : 0x00,    // DRY enabled, active high
+        0x01                        // EN_SENSOR
+    };
+    const uint32_t masks[] = {
+        0x1FF, 0x1FF, 0x1FF, 0x7FFF, 0x7FFF, 0x07, 0x60, 0x01
+    };
+    const int count = sizeof(requests) / sizeof(requests[0]);
+    uint64_t response;
+    SCHStatus sch1statusAll;
+
+    // Register reads are pipelined, each response belongs to the previous request.
+    SCHSpi48SendRequest(requests[0]);
+    for (int i = 0; i < count; i++)
+    {
+        response = SCHSpi48SendRequest(requests[(i + 1 < count) ? (i + 1) : i]);
+
+        if ((response == 0xFFFFFFFFFFFF) || (response == 0x00))
+            return false;
+        if (!SCHCheckCrc8(response) || (response & ERROR_FIELD_MASK))
+            return false;
+        if (((requests[i] & TA_FIELD_MASK) >> 38) != ((response & SA_FIELD_MASK) >> 37))
+            return false;
+        if ((((response & DATA_FIELD_MASK) >> 8) & masks[i]) != expected[i])
+            return false;
+    }
+
+    // Status registers latch, a stale flag from before the reset clears on the first read.
+    SCHGetStatus(&sch1statusAll);
+    if (!SCHVerifyStatus(&sch1statusAll)) {
         SCHGetStatus(&sch1statusAll);
+        if (!SCHVerifyStatus(&sch1statusAll))
+            return false;
+    }
 
-        // Read all user control registers and verify content - Add verification here if needed for FuSa.
+    initFilter = sFilter;
+    initSensitivity = sSensitivity;
+    initDecimation = sDecimation;
+    initEnableDry = enableDry;
+    initAttempt = 0;
+    activeSensitivity = sSensitivity;
+    SCHUpdateGains();
+    SCHResetHealth();
+    initState = SCH_INIT_READY;
 
-        // Check that all status registers have OK status.
-        if (!SCHVerifyStatus(&sch1statusAll)) {
-            sch1status = false;
-            SCHReset();    // Sensor failed, reset and retry.
-        }
-        else {
-            sch1status = true;
+    return true;
+}
+
+/**
+ * Initialize sensor, blocking. Runs the same state machine to completion.
+ */
+int32_t SCHInit(SCHFilter sFilter, SCHSensitivity sSensitivity, SCHDecimation sDecimation, bool enableDry)
+{
+    SCHInitState state;
+
+    SCHInitStart(sFilter, sSensitivity, sDecimation, enableDry);
+
+    do {
+        state = SCHInitPoll();
+    } while ((state != SCH_INIT_READY) && (state != SCH_INIT_FAILED));
+
+    return (state == SCH_INIT_READY) ? SCH_OK : SCH_ERR_SENSOR_INIT;
+}
+
+/**
+ * Reset status supervision, called when the sensor is (re)started
+ */
+void SCHResetHealth(void)
+{
+    memset(&health, 0, sizeof(health));
+    memset(statusBadReads, 0, sizeof(statusBadReads));
+    statusIndex = 0;
+}
+
+/**
+ * Decode one interleaved status register response
+ */
+static void SCHStatusUpdate(uint64_t request, uint64_t response)
+{
+    uint16_t *registers = (uint16_t *)&health.status;
+    uint16_t value;
+    int index;
+
+    for (index = 0; index < SCH_STATUS_REGISTERS; index++)
+    {
+        if (statusRequests[index] == request)
             break;
+    }
+    if (index >= SCH_STATUS_REGISTERS)
+        return;
+
+    // A corrupted frame says nothing about the sensor, skip it.
+    if (!SCHCheckCrc8(response) || (((request & TA_FIELD_MASK) >> 38) != ((response & SA_FIELD_MASK) >> 37)))
+        return;
+
+    value = SPI48_DATA_UINT16(response);
+    registers[index] = value;
+    health.reads++;
+    TraceWrite((value == 0xffff) ? TRACE_STATUS_READ : TRACE_STATUS_FAULT, (uint16_t)index);
+
+    if (value == 0xffff) {
+        statusBadReads[index] = 0;
+        health.faults &= ~statusHealthBits[index];
+        health.confirmed &= ~statusHealthBits[index];
+    }
+    else {
+        health.faults |= statusHealthBits[index];
+        if (statusBadReads[index] < SCH_STATUS_CONFIRM_READS)
+            statusBadReads[index]++;
+        if (statusBadReads[index] >= SCH_STATUS_CONFIRM_READS)
+            health.confirmed |= statusHealthBits[index];
+    }
+}
+
+/**
+ * Get status supervision state
+ */
+void SCHGetHealth(SCHHealth *healthOut)
+{
+    *healthOut = health;
+}
+
+/**
+ * Per-channel health flags (SCH_HEALTH_xxx), set = register not OK on last read
+ */
+uint16_t SCHGetHealthFlags(void)
+{
+    return health.faults;
+}
+
+/**
+ * True when a fault that needs sensor recovery has been confirmed. Saturation
+ * is a measurement condition, not a sensor fault.
+ */
+bool SCHFaultConfirmed(void)
+{
+    return (health.confirmed & (uint16_t)~SCH_HEALTH_SATURATION) != 0;
+}
+
+/**
+ * Decode error field and CRC of each frame, count errors in the current
+ * window block and return the quality bits of the failing channels.
+ */
+static uint16_t SCHFrameQuality(const uint64_t *frames, const uint16_t *channelBits, int size)
+{
+    SCHQualityWindow *block = &qualityBlocks[qualityBlock];
+    uint16_t quality = 0;
+
+    for (int i = 0; i < size; i++)
+    {
+        uint64_t frame = frames[i];
+        bool crcOk = SCHCheckCrc8(frame);
+
+        if (crcOk && ((frame & ERROR_FIELD_MASK) == 0))
+            continue;
+
+        quality |= channelBits[i];
+
+        if (!crcOk)
+            block->crcErrors++;
+        if (frame & ERROR_IDS_MASK)
+            block->idsErrors++;
+        if (frame & ERROR_CE_MASK)
+            block->ceErrors++;
+        if (frame & ERROR_RS_MASK)
+            block->rsErrors++;
+    }
+
+    return quality;
+}
+
+/**
+ * Close one sample in the sliding error window
+ */
+static void SCHQualityEndSample(uint16_t quality)
+{
+    SCHQualityWindow *block = &qualityBlocks[qualityBlock];
+
+    block->samples++;
+    if (quality != 0) {
+        block->badSamples++;
+        for (int channel = 0; channel < SCH_QUALITY_CHANNELS; channel++)
+        {
+            if (quality & (1U << channel))
+                block->channelErrors[channel]++;
         }
+    }
 
-    } // for (startupAttempt = 0; startupAttempt < 2; startupAttempt++)
+    if (block->samples >= SCH_QUALITY_BLOCK_SAMPLES) {
+        qualityBlock = (qualityBlock + 1) % SCH_QUALITY_WINDOW_BLOCKS;
+        memset(&qualityBlocks[qualityBlock], 0, sizeof(SCHQualityWindow));
+    }
+}
 
-    if (sch1status != true)
-        ret = SCH_ERR_SENSOR_INIT;
+/**
+ * Error counters over the last SCH_QUALITY_WINDOW_BLOCKS * SCH_QUALITY_BLOCK_SAMPLES samples
+ */
+void SCHGetQualityWindow(SCHQualityWindow *window)
+{
+    memset(window, 0, sizeof(SCHQualityWindow));
+
+    for (int i = 0; i < SCH_QUALITY_WINDOW_BLOCKS; i++)
+    {
+        const SCHQualityWindow *block = &qualityBlocks[i];
+
+        window->samples    += block->samples;
+        window->badSamples += block->badSamples;
+        window->crcErrors  += block->crcErrors;
+        window->idsErrors  += block->idsErrors;
+        window->ceErrors   += block->ceErrors;
+        window->rsErrors   += block->rsErrors;
+        for (int channel = 0; channel < SCH_QUALITY_CHANNELS; channel++)
+            window->channelErrors[channel] += block->channelErrors[channel];
+    }
+}
 
-    return ret;
+/**
+ * Read one complete sample: Rate1/Acc1/Temp, Rate2/Acc2 and one interleaved
+ * status register. Quality bits are accumulated into the error window.
+ */
+void SCHGetSample(SCHRawData *data)
+{
+    TraceWrite(TRACE_SPI_START, 0);
+    SCHGetData(data);
+    SCHGetData2(data);
+    SCHQualityEndSample(data->quality);
+    TraceWrite(TRACE_SPI_END, data->quality);
 }
 
 /**
@@ -897,7 +1288,10 @@ int32_t SCHInit(SCHFilter sFilter, SCHSensitivity sSensitivity, SCHDecimation sD
  */
 void SCHGetData(SCHRawData *data)
 {
-    SCHSpi48SendRequest(REQ_READ_RATE_X1);
+    // First response answers the status request appended by SCHGetData2().
+    uint64_t pendingRequest = lastRequest;
+    PROF_START(PROF_SPI_DATA1);
+    uint64_t pendingRaw = SCHSpi48SendRequest(REQ_READ_RATE_X1);
     uint64_t rateXRaw = SCHSpi48SendRequest(REQ_READ_RATE_Y1);
     uint64_t rateYRaw = SCHSpi48SendRequest(REQ_READ_RATE_Z1);
     uint64_t rateZRaw = SCHSpi48SendRequest(REQ_READ_ACC_X1);
@@ -905,10 +1299,16 @@ void SCHGetData(SCHRawData *data)
     uint64_t accYRaw  = SCHSpi48SendRequest(REQ_READ_ACC_Z1);
     uint64_t accZRaw  = SCHSpi48SendRequest(REQ_READ_TEMP);
     uint64_t tempRaw  = SCHSpi48SendRequest(REQ_READ_TEMP);
+    PROF_END(PROF_SPI_DATA1);
+
+    SCHStatusUpdate(pendingRequest, pendingRaw);
 
-    // Get possible frame errors
+    // Decode frame errors per channel
     uint64_t misoWords[] = {rateXRaw, rateYRaw, rateZRaw, accXRaw, accYRaw, accZRaw, tempRaw};
-    data->frameError = SCHCheck48BitFrameError(misoWords, (sizeof(misoWords) / sizeof(uint64_t)));
+    PROF_START(PROF_FRAME_CHECK);
+    data->quality = SCHFrameQuality(misoWords, data1QualityBits, (sizeof(misoWords) / sizeof(uint64_t)));
+    PROF_END(PROF_FRAME_CHECK);
+    data->frameError = (data->quality != 0);
 
     // Parse MISO data to structure
     data->rate1Raw[AXIS_X] = SPI48_DATA_INT32(rateXRaw);
@@ -923,22 +1323,45 @@ void SCHGetData(SCHRawData *data)
 }
 
 /**
- * Read rate2/acc2 (decimated) data
+ * Read rate2/acc2 (decimated) data, and Acc3 when enabled. The last frame
+ * requests the next status register in round-robin order, so all ten are
+ * refreshed every ten samples.
  */
 void SCHGetData2(SCHRawData *data)
 {
+    uint64_t statusRequest = statusRequests[statusIndex];
+    uint64_t acc3Raw[3];
+    bool withAcc3 = (readAcc3 != 0);    // One decision for the whole sample
+
+    if (++statusIndex >= SCH_STATUS_REGISTERS)
+        statusIndex = 0;
+
+    PROF_START(PROF_SPI_DATA2);
     SCHSpi48SendRequest(REQ_READ_RATE_X2);
     uint64_t rateXRaw = SCHSpi48SendRequest(REQ_READ_RATE_Y2);
     uint64_t rateYRaw = SCHSpi48SendRequest(REQ_READ_RATE_Z2);
     uint64_t rateZRaw = SCHSpi48SendRequest(REQ_READ_ACC_X2);
     uint64_t accXRaw  = SCHSpi48SendRequest(REQ_READ_ACC_Y2);
     uint64_t accYRaw  = SCHSpi48SendRequest(REQ_READ_ACC_Z2);
-    uint64_t accZRaw  = SCHSpi48SendRequest(REQ_READ_TEMP);
-    uint64_t tempRaw  = SCHSpi48SendRequest(REQ_READ_TEMP);
+    uint64_t accZRaw;
+    if (withAcc3) {
+        accZRaw    = SCHSpi48SendRequest(REQ_READ_ACC_X3);
+        acc3Raw[0] = SCHSpi48SendRequest(REQ_READ_ACC_Y3);
+        acc3Raw[1] = SCHSpi48SendRequest(REQ_READ_ACC_Z3);
+        acc3Raw[2] = SCHSpi48SendRequest(statusRequest);
+    } else {
+        accZRaw    = SCHSpi48SendRequest(statusRequest);
+    }
+    PROF_END(PROF_SPI_DATA2);
 
-    // Get possible frame errors
-    uint64_t misoWords[] = {rateXRaw, rateYRaw, rateZRaw, accXRaw, accYRaw, accZRaw, tempRaw};
-    data->frameError = SCHCheck48BitFrameError(misoWords, (sizeof(misoWords) / sizeof(uint64_t)));
+    // Decode frame errors per channel, added to the Rate1/Acc1/Temp quality of SCHGetData()
+    uint64_t misoWords[] = {rateXRaw, rateYRaw, rateZRaw, accXRaw, accYRaw, accZRaw};
+    PROF_START(PROF_FRAME_CHECK);
+    data->quality |= SCHFrameQuality(misoWords, data2QualityBits, (sizeof(misoWords) / sizeof(uint64_t)));
+    if (withAcc3)
+        data->quality |= SCHFrameQuality(acc3Raw, data3QualityBits, (sizeof(acc3Raw) / sizeof(uint64_t)));
+    PROF_END(PROF_FRAME_CHECK);
+    data->frameError = (data->quality != 0);
 
     // Parse MISO data to structure
     data->rate2Raw[AXIS_X] = SPI48_DATA_INT32(rateXRaw);
@@ -947,6 +1370,109 @@ void SCHGetData2(SCHRawData *data)
     data->acc2Raw[AXIS_X]  = SPI48_DATA_INT32(accXRaw);
     data->acc2Raw[AXIS_Y]  = SPI48_DATA_INT32(accYRaw);
     data->acc2Raw[AXIS_Z]  = SPI48_DATA_INT32(accZRaw);
+    if (withAcc3) {
+        data->acc3Raw[AXIS_X] = SPI48_DATA_INT32(acc3Raw[0]);
+        data->acc3Raw[AXIS_Y] = SPI48_DATA_INT32(acc3Raw[1]);
+        data->acc3Raw[AXIS_Z] = SPI48_DATA_INT32(acc3Raw[2]);
+    } else {
+        data->acc3Raw[AXIS_X] = 0;
+        data->acc3Raw[AXIS_Y] = 0;
+        data->acc3Raw[AXIS_Z] = 0;
+    }
+}
+
+/**
+ * Add the three Acc3 frames to every sample while at least one user
+ * (SCH_ACC3_xxx) needs them
+ */
+void SCHSetReadAcc3(uint8_t user, bool enable)
+{
+    uint32_t basepri = CriticalEnter();
+
+    if (enable)
+        readAcc3 |= user;
+    else
+        readAcc3 &= (uint8_t)~user;
+    CriticalExit(basepri);
+}
+
+/**
+ * 48-bit SPI frames per sample: Rate1/Acc1/Temp, Rate2/Acc2, optional Acc3, status
+ */
+uint8_t SCHGetReadFrames(void)
+{
+    return (readAcc3 != 0) ? 18 : 15;
+}
+
+/**
+ * Set calibration applied by SCHConvertData()
+ */
+void SCHSetCalibration(const SCHCalibration *cal)
+{
+    if (cal == NULL)
+        return;
+
+    activeCalibration = *cal;
+    SCHUpdateGains();
+    SCHUpdateBias();
+}
+
+/**
+ * Replace the Rate1 calibration bias by a tracked bias, Q8 LSB.
+ * NULL returns to the calibration bias.
+ */
+void SCHSetRate1BiasTrack(const int32_t *biasQ8)
+{
+    rate1BiasTracking = (biasQ8 != NULL);
+    if (rate1BiasTracking) {
+        for (int axis = AXIS_X; axis <= AXIS_Z; axis++)
+            rate1TrackedBias[axis] = biasQ8[axis];
+    }
+    SCHUpdateBias();
+}
+
+static void SCHUpdateBias(void)
+{
+    for (int axis = AXIS_X; axis <= AXIS_Z; axis++)
+    {
+        rate1BiasQ8[axis] = rate1BiasTracking ? rate1TrackedBias[axis] : (activeCalibration.rate1Bias[axis] * 256);
+        rate1Offset[axis] = (float)rate1BiasQ8[axis] * (1.0f / 256.0f);
+    }
+}
+
+/**
+ * Precompute per-axis gains (1 / sensitivity) from nominal sensitivities and calibration
+ */
+static void SCHUpdateGains(void)
+{
+    for (int axis = AXIS_X; axis <= AXIS_Z; axis++)
+    {
+        float rateSens = activeCalibration.rate1Scale[axis] > 0.0f ? activeCalibration.rate1Scale[axis] : (float)activeSensitivity.rate1;
+        float accSens  = activeCalibration.acc1Scale[axis] > 0.0f ? activeCalibration.acc1Scale[axis] : (float)activeSensitivity.acc1;
+
+        rate1Gain[axis] = 1.0f / (rateSens * (float)AVG_FACTOR);
+        acc1Gain[axis]  = 1.0f / (accSens * (float)AVG_FACTOR);
+    }
+
+    rate2Gain = 1.0f / ((float)activeSensitivity.rate2 * (float)AVG_FACTOR);
+    acc2Gain  = 1.0f / ((float)activeSensitivity.acc2 * (float)AVG_FACTOR);
+    acc3Gain  = 1.0f / ((float)activeSensitivity.acc3 * (float)AVG_FACTOR);
+}
+
+/**
+ * Rate1 axis as bias corrected raw counts, for fixed-point consumers
+ */
+int32_t SCHGetRate1Counts(const SCHRawData *data, int axis)
+{
+    return ((data->rate1Raw[axis] * 256) - rate1BiasQ8[axis] + 128) >> 8;
+}
+
+/**
+ * Rate1 scale (dps per raw count) including calibration and averaging
+ */
+float SCHGetRate1Gain(int axis)
+{
+    return rate1Gain[axis];
 }
 
 /**
@@ -954,21 +1480,26 @@ void SCHGetData2(SCHRawData *data)
  */
 void SCHConvertData(SCHRawData *dataIn, SCHResult *dataOut)
 {
-    // Convert from raw counts to sensitivity and calculate averages here for faster execution
-    dataOut->rate1[AXIS_X] = (float)dataIn->rate1Raw[AXIS_X] / (SENSITIVITY_RATE1 * (float)AVG_FACTOR);
-    dataOut->rate1[AXIS_Y] = (float)dataIn->rate1Raw[AXIS_Y] / (SENSITIVITY_RATE1 * (float)AVG_FACTOR);
-    dataOut->rate1[AXIS_Z] = (float)dataIn->rate1Raw[AXIS_Z] / (SENSITIVITY_RATE1 * (float)AVG_FACTOR);
-    dataOut->acc1[AXIS_X]  = (float)dataIn->acc1Raw[AXIS_X] / (SENSITIVITY_ACC1 * (float)AVG_FACTOR);
-    dataOut->acc1[AXIS_Y]  = (float)dataIn->acc1Raw[AXIS_Y] / (SENSITIVITY_ACC1 * (float)AVG_FACTOR);
-    dataOut->acc1[AXIS_Z]  = (float)dataIn->acc1Raw[AXIS_Z] / (SENSITIVITY_ACC1 * (float)AVG_FACTOR);
+    // Gains already include sensitivity, calibration and averaging; apply bias and multiply.
+    dataOut->rate1[AXIS_X] = ((float)dataIn->rate1Raw[AXIS_X] - rate1Offset[AXIS_X]) * rate1Gain[AXIS_X];
+    dataOut->rate1[AXIS_Y] = ((float)dataIn->rate1Raw[AXIS_Y] - rate1Offset[AXIS_Y]) * rate1Gain[AXIS_Y];
+    dataOut->rate1[AXIS_Z] = ((float)dataIn->rate1Raw[AXIS_Z] - rate1Offset[AXIS_Z]) * rate1Gain[AXIS_Z];
+    dataOut->acc1[AXIS_X]  = (float)(dataIn->acc1Raw[AXIS_X] - activeCalibration.acc1Bias[AXIS_X]) * acc1Gain[AXIS_X];
+    dataOut->acc1[AXIS_Y]  = (float)(dataIn->acc1Raw[AXIS_Y] - activeCalibration.acc1Bias[AXIS_Y]) * acc1Gain[AXIS_Y];
+    dataOut->acc1[AXIS_Z]  = (float)(dataIn->acc1Raw[AXIS_Z] - activeCalibration.acc1Bias[AXIS_Z]) * acc1Gain[AXIS_Z];
 
     // Convert Rate2 and Acc2
-    dataOut->rate2[AXIS_X] = (float)dataIn->rate2Raw[AXIS_X] / (SENSITIVITY_RATE1 * (float)AVG_FACTOR);
-    dataOut->rate2[AXIS_Y] = (float)dataIn->rate2Raw[AXIS_Y] / (SENSITIVITY_RATE1 * (float)AVG_FACTOR);
-    dataOut->rate2[AXIS_Z] = (float)dataIn->rate2Raw[AXIS_Z] / (SENSITIVITY_RATE1 * (float)AVG_FACTOR);
-    dataOut->acc2[AXIS_X]  = (float)dataIn->acc2Raw[AXIS_X] / (SENSITIVITY_ACC1 * (float)AVG_FACTOR);
-    dataOut->acc2[AXIS_Y]  = (float)dataIn->acc2Raw[AXIS_Y] / (SENSITIVITY_ACC1 * (float)AVG_FACTOR);
-    dataOut->acc2[AXIS_Z]  = (float)dataIn->acc2Raw[AXIS_Z] / (SENSITIVITY_ACC1 * (float)AVG_FACTOR);
+    dataOut->rate2[AXIS_X] = (float)dataIn->rate2Raw[AXIS_X] * rate2Gain;
+    dataOut->rate2[AXIS_Y] = (float)dataIn->rate2Raw[AXIS_Y] * rate2Gain;
+    dataOut->rate2[AXIS_Z] = (float)dataIn->rate2Raw[AXIS_Z] * rate2Gain;
+    dataOut->acc2[AXIS_X]  = (float)dataIn->acc2Raw[AXIS_X] * acc2Gain;
+    dataOut->acc2[AXIS_Y]  = (float)dataIn->acc2Raw[AXIS_Y] * acc2Gain;
+    dataOut->acc2[AXIS_Z]  = (float)dataIn->acc2Raw[AXIS_Z] * acc2Gain;
+
+    // Acc3 reads zero unless enabled with SCHSetReadAcc3()
+    dataOut->acc3[AXIS_X]  = (float)dataIn->acc3Raw[AXIS_X] * acc3Gain;
+    dataOut->acc3[AXIS_Y]  = (float)dataIn->acc3Raw[AXIS_Y] * acc3Gain;
+    dataOut->acc3[AXIS_Z]  = (float)dataIn->acc3Raw[AXIS_Z] * acc3Gain;
 
     // Convert temperature and calculate average
     dataOut->temp = GET_TEMPERATURE((float)dataIn->tempRaw / (float)AVG_FACTOR);
@@ -86,6 +86,13 @@
 #define CRC_FIELD_MASK              0x0000000000FF
 #define ERROR_FIELD_MASK            0x001E00000000
 
+/**
+ * Error field bits of a MISO frame
+ */
+#define ERROR_IDS_MASK              0x001000000000  // Internal data status error
+#define ERROR_CE_MASK               0x000800000000  // Command error
+#define ERROR_RS_MASK               0x000600000000  // Return status, non-zero = data not valid
+
 /**
  * Macros
  */
@@ -112,6 +119,57 @@
 #define DECIMATION_RATE     32          // DEC5, Output sample rate decimation.
 #define DECIMATION_ACC      32
 
+#define SCH_INIT_ATTEMPTS   2           // Startup sequence attempts before SCH_INIT_FAILED
+
+/**
+ * Status supervision
+ */
+#define SCH_STATUS_REGISTERS        10
+#define SCH_STATUS_CONFIRM_READS    3   // Consecutive bad reads of a register before a fault is confirmed
+
+/**
+ * Per-sample quality, one bit per channel. Set = the channel's MISO frame
+ * had error field bits or a CRC mismatch; the value should not be used.
+ */
+#define SCH_QUALITY_CHANNELS        16
+#define SCH_QUALITY_RATE1_X         0x0001
+#define SCH_QUALITY_RATE1_Y         0x0002
+#define SCH_QUALITY_RATE1_Z         0x0004
+#define SCH_QUALITY_ACC1_X          0x0008
+#define SCH_QUALITY_ACC1_Y          0x0010
+#define SCH_QUALITY_ACC1_Z          0x0020
+#define SCH_QUALITY_RATE2_X         0x0040
+#define SCH_QUALITY_RATE2_Y         0x0080
+#define SCH_QUALITY_RATE2_Z         0x0100
+#define SCH_QUALITY_ACC2_X          0x0200
+#define SCH_QUALITY_ACC2_Y          0x0400
+#define SCH_QUALITY_ACC2_Z          0x0800
+#define SCH_QUALITY_TEMP            0x1000
+#define SCH_QUALITY_ACC3_X          0x2000  // Acc3 only while SCHSetReadAcc3() is on
+#define SCH_QUALITY_ACC3_Y          0x4000
+#define SCH_QUALITY_ACC3_Z          0x8000
+
+/**
+ * SCHSetReadAcc3() users, Acc3 is read while any of them needs it
+ */
+#define SCH_ACC3_CAPTURE            0x01
+#define SCH_ACC3_TILT               0x02
+
+#define SCH_QUALITY_BLOCK_SAMPLES   100 // Sliding error window: blocks of 100 samples...
+#define SCH_QUALITY_WINDOW_BLOCKS   10  // ...10 blocks per window
+
+// Health flags, one per status register. Set = register not OK.
+#define SCH_HEALTH_SUMMARY          0x0001
+#define SCH_HEALTH_SATURATION       0x0002
+#define SCH_HEALTH_COMMON           0x0004
+#define SCH_HEALTH_RATE_COMMON      0x0008
+#define SCH_HEALTH_RATE_X           0x0010
+#define SCH_HEALTH_RATE_Y           0x0020
+#define SCH_HEALTH_RATE_Z           0x0040
+#define SCH_HEALTH_ACC_X            0x0080
+#define SCH_HEALTH_ACC_Y            0x0100
+#define SCH_HEALTH_ACC_Z            0x0200
+
 /**
  * Structs
  */
@@ -122,7 +180,8 @@ typedef struct {
     int32_t acc2Raw[3];
     int32_t acc3Raw[3];
     int32_t tempRaw;
-    bool frameError;
+    uint16_t quality;           // SCH_QUALITY_xxx
+    bool frameError;            // quality != 0
 } SCHRawData;
 
 typedef struct {
@@ -144,6 +203,23 @@ typedef struct {
     uint16_t accZ;
 } SCHStatus;
 
+typedef struct {
+    SCHStatus status;           // Last value read from each status register
+    uint16_t  faults;           // SCH_HEALTH_xxx, not OK on the last read
+    uint16_t  confirmed;        // SCH_HEALTH_xxx, not OK on SCH_STATUS_CONFIRM_READS consecutive reads
+    uint32_t  reads;
+} SCHHealth;
+
+typedef struct {
+    uint16_t samples;           // Samples in the window
+    uint16_t badSamples;        // Samples with at least one quality bit set
+    uint16_t crcErrors;         // Frames with CRC mismatch
+    uint16_t idsErrors;         // Frames with ERROR_IDS_MASK set
+    uint16_t ceErrors;          // Frames with ERROR_CE_MASK set
+    uint16_t rsErrors;          // Frames with ERROR_RS_MASK bits set
+    uint16_t channelErrors[SCH_QUALITY_CHANNELS];
+} SCHQualityWindow;
+
 typedef struct {
     float rate1[3];
     float rate2[3];
@@ -166,6 +242,23 @@ typedef struct {
     uint16_t acc2;
 } SCHDecimation;
 
+typedef struct {
+    int32_t rate1Bias[3];       // LSB, subtracted before scaling
+    float   rate1Scale[3];      // LSB / dps, 0 = use nominal sensitivity
+    int32_t acc1Bias[3];        // LSB
+    float   acc1Scale[3];       // LSB / m/s2, 0 = use nominal sensitivity
+} SCHCalibration;
+
+typedef enum {
+    SCH_INIT_IDLE,
+    SCH_INIT_RESET,         // EXTRESN low
+    SCH_INIT_NVM_READ,      // 32 ms NVM read
+    SCH_INIT_STARTUP,       // 215 ms start-up after EN_SENSOR
+    SCH_INIT_EOI,           // 3 ms after EOI
+    SCH_INIT_READY,
+    SCH_INIT_FAILED
+} SCHInitState;
+
 typedef enum {
     AXIS_X,
     AXIS_Y,
@@ -174,10 +267,26 @@ typedef enum {
 
 extern SCHRawData raw;
 
+void SCHGetSample(SCHRawData *data);
+void SCHGetQualityWindow(SCHQualityWindow *window);
 void SCHGetData(SCHRawData *data);
 void SCHGetData2(SCHRawData *data);
+void SCHSetReadAcc3(uint8_t user, bool enable);
+uint8_t SCHGetReadFrames(void);
 void SCHReset(void);
 int32_t  SCHInit(SCHFilter sFilter, SCHSensitivity sSensitivity, SCHDecimation sDecimation, bool enableDry);
+void SCHInitStart(SCHFilter sFilter, SCHSensitivity sSensitivity, SCHDecimation sDecimation, bool enableDry);
+SCHInitState SCHInitPoll(void);
+bool SCHWarmStart(SCHFilter sFilter, SCHSensitivity sSensitivity, SCHDecimation sDecimation, bool enableDry);
+SCHInitState SCHGetInitState(void);
+uint8_t SCHGetInitAttempt(void);
+void SCHSetCalibration(const SCHCalibration *cal);
+void SCHSetRate1BiasTrack(const int32_t *biasQ8);
+bool SCHIsValidFilterFreq(uint32_t freq);
+bool SCHIsValidRateSens(uint32_t sens);
+bool SCHIsValidAccSens(uint32_t sens);
+bool SCHIsValidDecimation(uint32_t decimation);
+bool SCHIsValidSampleRate(uint32_t freq);
 uint32_t SCHConvertFilterToBitfield(uint32_t freq);
 uint32_t SCHConvertRateSensToBitfield(uint32_t sens);
 uint32_t SCHConvertBitfieldToRateSens(uint32_t bitfield);
@@ -187,6 +296,12 @@ uint32_t SCHConvertDecimationToBitfield(uint32_t decimation);
 uint32_t SCHConvertBitfieldToDecimation(uint32_t bitfield);
 bool SCHCheck48BitFrameError(uint64_t *data, int size);
 void SCHConvertData(SCHRawData *dataIn, SCHResult *dataOut);
+int32_t SCHGetRate1Counts(const SCHRawData *data, int axis);
+float SCHGetRate1Gain(int axis);
 int32_t SCHGetStatus(SCHStatus *statusOut);
+void SCHResetHealth(void);
+void SCHGetHealth(SCHHealth *healthOut);
+uint16_t SCHGetHealthFlags(void);
+bool SCHFaultConfirmed(void);
 char* SCHGetSnbr(void);
 #endif
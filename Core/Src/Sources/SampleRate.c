@@ -0,0 +1,234 @@
+/* SampleRate.c
+ * Acquisition rate: TIM2 prescaler/period for a requested frequency and the
+ * budget check of the read plan against it.
+ *
+ * A rate is accepted when the sample path (SPI reads, conversion, control
+ * and packet output) fits in SAMPLE_RATE_CPU_SHARE of the sample period, and
+ * the sample stream at the output divider fits in SAMPLE_RATE_LINK_SHARE of
+ * the link. The sample path cost is measured on every sample; until the
+ * sensor streams SAMPLE_RATE_COST_ESTIMATE_US is assumed. Rates that do not
+ * fit are rejected, or clamped to the highest rate that does on request.
+ *
+ * The motion planner refill and housekeeping are posted from SysTick and do
+ * not depend on the acquisition rate.
+ */
+
+#include "SampleRate.h"
+#include "ConfigStore.h"
+#include "Protocol.h"
+#include "Calibration.h"
+#include "Controller.h"
+#include "Stepper.h"
+#include "main.h"
+#include "tim.h"
+
+static uint32_t rate = SAMPLE_RATE_DEFAULT_HZ;
+static uint32_t requested = SAMPLE_RATE_DEFAULT_HZ;
+static uint8_t reason = SAMPLE_RATE_OK;
+static uint32_t prescaler = 1;          // Timer clock divider, PSC + 1
+static uint32_t period = SAMPLE_RATE_TIMER_HZ / SAMPLE_RATE_DEFAULT_HZ;     // ARR + 1
+
+// Sample path cost, worst case per window of one second of samples
+static uint32_t costMax = 0;
+static uint32_t costLastMax = 0;
+static uint32_t costSamples = 0;
+
+/**
+ * Timer prescaler and period for a rate: the smallest prescaler that fits
+ * the period in 16 bits, for the finest frequency resolution
+ */
+static void SampleRateTiming(uint32_t freq, uint32_t *prescalerOut, uint32_t *periodOut)
+{
+    uint32_t ticks = (SAMPLE_RATE_TIMER_HZ + freq / 2) / freq;
+    uint32_t psc = (ticks + 0xFFFF) / 0x10000;
+    uint32_t arr = (ticks + psc / 2) / psc;
+
+    *prescalerOut = psc;
+    *periodOut = (arr > 0x10000) ? 0x10000 : arr;
+}
+
+/**
+ * Load the new period without a spurious update interrupt, the next sample
+ * follows one new period after the call
+ */
+static void SampleRateApply(uint32_t psc, uint32_t arr)
+{
+    uint32_t running = TIM2->CR1 & TIM_CR1_CEN;
+
+    TIM2->CR1 &= ~TIM_CR1_CEN;
+    TIM2->PSC = psc - 1;
+    TIM2->ARR = arr - 1;
+    TIM2->CNT = 0;
+    TIM2->CR1 |= TIM_CR1_URS;       // UG loads PSC without setting the update flag
+    TIM2->EGR = TIM_EGR_UG;
+    TIM2->CR1 &= ~TIM_CR1_URS;
+    TIM2->CR1 |= running;
+
+    htim2.Init.Prescaler = psc - 1;
+    htim2.Init.Period = arr - 1;
+    prescaler = psc;
+    period = arr;
+}
+
+/**
+ * Link bytes per streamed sample, including framing
+ */
+static uint32_t SampleRateFrameSize(void)
+{
+    uint32_t size = sizeof(PktSample) + LINK_HEADER_SIZE + LINK_CRC_SIZE;
+
+    if (appConfig.streams & STREAM_CONTROLLER)
+        size += sizeof(ControllerTelemetry);
+    if (appConfig.streams & STREAM_STEPPER)
+        size += sizeof(StepperTag);
+
+    return size;
+}
+
+/**
+ * Link capacity available to the sample stream, bytes/s (10 bits per byte)
+ */
+static uint32_t SampleRateLinkCapacity(void)
+{
+    return (appConfig.baudRate / 10U) * SAMPLE_RATE_LINK_SHARE / 1000U;
+}
+
+static uint32_t SampleRateCostUs(void)
+{
+    uint32_t cycles = (costMax > costLastMax) ? costMax : costLastMax;
+
+    if (cycles == 0)
+        return SAMPLE_RATE_COST_ESTIMATE_US;
+
+    return (cycles + (SAMPLE_RATE_TIMER_HZ / 1000000U) - 1) / (SAMPLE_RATE_TIMER_HZ / 1000000U);
+}
+
+/**
+ * Apply the configured rate at boot. Only the range is checked, the budget
+ * was checked when the rate was set.
+ */
+void SampleRateInit(void)
+{
+    uint32_t psc, arr;
+
+    rate = SCHIsValidSampleRate(appConfig.sampleRate) ? appConfig.sampleRate : SAMPLE_RATE_DEFAULT_HZ;
+    requested = rate;
+    reason = SAMPLE_RATE_OK;
+    costMax = 0;
+    costLastMax = 0;
+    costSamples = 0;
+
+    SampleRateTiming(rate, &psc, &arr);
+    SampleRateApply(psc, arr);
+}
+
+/**
+ * @brief Set the acquisition rate.
+ *
+ * @param freq - requested rate, Hz
+ * @param clamp - apply the highest rate within budget instead of rejecting
+ * @return SCH_OK, SCH_ERR_INVALID_PARAM when outside the valid range,
+ *         SCH_ERR_OTHER when over budget or calibration is running.
+ *         The reason is in SampleRatePlan.reason.
+ */
+int32_t SampleRateSet(uint32_t freq, bool clamp)
+{
+    uint32_t maxRate = 10000;
+    uint32_t limit;
+    uint8_t limitReason = SAMPLE_RATE_OK;
+    uint32_t psc, arr;
+
+    requested = freq;
+
+    if (!SCHIsValidSampleRate(freq)) {
+        reason = SAMPLE_RATE_RANGE;
+        return SCH_ERR_INVALID_PARAM;
+    }
+    // The rate table measures time in samples
+    if (CalibrationIsBusy()) {
+        reason = SAMPLE_RATE_BUSY;
+        return SCH_ERR_OTHER;
+    }
+
+    limit = (1000U * SAMPLE_RATE_CPU_SHARE) / SampleRateCostUs();
+    if (limit < maxRate) {
+        maxRate = limit;
+        limitReason = SAMPLE_RATE_CPU;
+    }
+    if (appConfig.streams & STREAM_SAMPLES) {
+        limit = (uint32_t)(((uint64_t)SampleRateLinkCapacity() * appConfig.outputDivider) / SampleRateFrameSize());
+        if (limit < maxRate) {
+            maxRate = limit;
+            limitReason = SAMPLE_RATE_LINK;
+        }
+    }
+
+    reason = SAMPLE_RATE_OK;
+    if (freq > maxRate) {
+        reason = limitReason;
+        if (!clamp || (maxRate < 1))
+            return SCH_ERR_OTHER;
+        freq = maxRate;
+    }
+
+    SampleRateTiming(freq, &psc, &arr);
+    SampleRateApply(psc, arr);
+    rate = freq;
+    appConfig.sampleRate = freq;
+
+    // Loop gains are scaled with the sample time
+    ControllerConfigure();
+
+    return SCH_OK;
+}
+
+/**
+ * Acquisition rate, Hz
+ */
+uint32_t SampleRateGet(void)
+{
+    return rate;
+}
+
+void SampleRateGetPlan(SampleRatePlan *plan)
+{
+    uint32_t samplePeriodUs = 1000000U / rate;
+    uint32_t streamed = (appConfig.streams & STREAM_SAMPLES) ? SampleRateFrameSize() : 0;
+    uint32_t linkLoad;
+
+    plan->requested = requested;
+    plan->rate = rate;
+    plan->actualMilliHz = (uint32_t)(((uint64_t)SAMPLE_RATE_TIMER_HZ * 1000U) / (prescaler * period));
+    plan->prescaler = (uint16_t)(prescaler - 1);
+    plan->period = (uint16_t)(period - 1);
+    plan->costUs = (uint16_t)SampleRateCostUs();
+    plan->budgetUs = (uint16_t)((samplePeriodUs * SAMPLE_RATE_CPU_SHARE) / 1000U);
+    linkLoad = (uint32_t)(((uint64_t)rate * streamed * 10000U) /
+                          ((uint64_t)appConfig.outputDivider * appConfig.baudRate));
+    plan->linkLoad = (uint16_t)((linkLoad > UINT16_MAX) ? UINT16_MAX : linkLoad);
+    plan->frames = SCHGetReadFrames();
+    plan->reason = reason;
+}
+
+/**
+ * Record the cost of one sample, DWT cycles. Called from the sample handler.
+ */
+void SampleRateAddCost(uint32_t cycles)
+{
+    if (cycles > costMax)
+        costMax = cycles;
+
+    if (++costSamples >= rate) {
+        costLastMax = costMax;
+        costMax = 0;
+        costSamples = 0;
+    }
+}
+
+/**
+ * TIM2 counter ticks to microseconds, for the latency probes
+ */
+uint32_t SampleRateTicksToUs(uint32_t ticks)
+{
+    return (ticks * prescaler) / (SAMPLE_RATE_TIMER_HZ / 1000000U);
+}
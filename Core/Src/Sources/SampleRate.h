@@ -0,0 +1,44 @@
+#ifndef _SAMPLERATE_H
+#define _SAMPLERATE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SAMPLE_RATE_DEFAULT_HZ      1000
+#define SAMPLE_RATE_TIMER_HZ        64000000    // TIM2 kernel clock (APB1 timer clock)
+#define SAMPLE_RATE_COST_ESTIMATE_US 200        // Sample path cost assumed before it has been measured
+#define SAMPLE_RATE_CPU_SHARE       800         // Per mille of the sample period the sample path may use
+#define SAMPLE_RATE_LINK_SHARE      900         // Per mille of the link capacity the sample stream may use
+
+/**
+ * Why a rate was rejected or clamped (ACK detail, SampleRatePlan.reason)
+ */
+#define SAMPLE_RATE_OK              0
+#define SAMPLE_RATE_RANGE           1   // Outside 1..10000 Hz
+#define SAMPLE_RATE_CPU             2   // Sample period shorter than the measured sample path cost
+#define SAMPLE_RATE_LINK            3   // Sample stream exceeds the link capacity at the output divider
+#define SAMPLE_RATE_BUSY            4   // Rate table calibration running
+
+/**
+ * PKT_SAMPLE_RATE payload: the active read plan and its budget
+ */
+typedef struct {
+    uint32_t requested;         // Hz, last request
+    uint32_t rate;              // Hz, applied
+    uint32_t actualMilliHz;     // Timer frequency after prescaler/period rounding
+    uint16_t prescaler;         // TIM2 PSC, timer clock divider - 1
+    uint16_t period;            // TIM2 ARR, timer ticks per sample - 1
+    uint16_t costUs;            // Measured sample path cost, worst case over the last second
+    uint16_t budgetUs;          // Share of the sample period available to the sample path
+    uint16_t linkLoad;          // Sample stream share of the link capacity, per mille
+    uint8_t  frames;            // SPI frames per sample
+    uint8_t  reason;            // SAMPLE_RATE_xxx of the last request
+} SampleRatePlan;
+
+void SampleRateInit(void);
+int32_t SampleRateSet(uint32_t rate, bool clamp);
+uint32_t SampleRateGet(void);
+void SampleRateGetPlan(SampleRatePlan *plan);
+void SampleRateAddCost(uint32_t cycles);
+uint32_t SampleRateTicksToUs(uint32_t ticks);
+#endif
@@ -0,0 +1,157 @@
+/* Scheduler.c
+ * Run-to-completion event scheduler for the main loop.
+ *
+ * Interrupts post event bits, SchedulerDispatch() runs the handler of the
+ * highest priority pending event and puts the core to sleep (WFI) when
+ * nothing is pending. The check for pending events and WFI are done with
+ * interrupts disabled, an event posted in between still wakes the core.
+ *
+ * CPU load is the share of DWT cycles spent awake (handlers and interrupts)
+ * over SCHEDULER_LOAD_WINDOW_MS, counted from each wake-up to the next WFI.
+ *
+ * Background work (the spectrum transform) is split into short steps, each
+ * step posts the lowest priority event again so acquisition, motion and
+ * commands run in between.
+ *
+ * Housekeeping (periodic reports) is an event like the others, below the
+ * sample, motor and command events. It never preempts a handler, so the
+ * polled SPI sequence of a sample runs without gaps and the reports read
+ * sample handler state without locking.
+ *
+ * The latency probes record how late the acquisition path runs after the
+ * TIM2 update event, read from the TIM2 counter (converted to microseconds,
+ * wraps at the sample period).
+ */
+
+#include "Scheduler.h"
+#include "main.h"
+
+static volatile uint32_t pending = 0;
+static SchedulerHandler handlers[SCHEDULER_EVENTS];
+static volatile SchedulerLatency latency;
+
+static uint32_t wakeCycles;             // DWT->CYCCNT at the last wake-up
+static uint32_t busyCycles;             // Awake cycles in the current window
+static uint32_t windowStartMs;
+static uint16_t load = 0;               // Per mille, last complete window
+
+/**
+ * Start the cycle counter used for the load measurement
+ */
+void SchedulerInit(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    pending = 0;
+    busyCycles = 0;
+    for (uint8_t i = 0; i < SCHEDULER_PROBES; i++) {
+        latency.windowMax[i] = 0;
+        latency.peak[i] = 0;
+    }
+    wakeCycles = DWT->CYCCNT;
+    windowStartMs = HAL_GetTick();
+}
+
+void SchedulerRegister(uint8_t event, SchedulerHandler handler)
+{
+    if (event < SCHEDULER_EVENTS)
+        handlers[event] = handler;
+}
+
+/**
+ * Mark an event pending, callable from any interrupt. Posting an event that
+ * is still pending merges the two; posters that must not lose occurrences
+ * (the sample tick) count them themselves.
+ */
+void SchedulerPost(uint8_t event)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    pending |= (1UL << event);
+    __set_PRIMASK(primask);
+}
+
+/**
+ * Close the load window once it has elapsed
+ */
+static void SchedulerUpdateLoad(void)
+{
+    uint32_t elapsed = HAL_GetTick() - windowStartMs;
+
+    if (elapsed < SCHEDULER_LOAD_WINDOW_MS)
+        return;
+
+    load = (uint16_t)(((uint64_t)busyCycles * 1000U) / ((uint64_t)elapsed * (SystemCoreClock / 1000U)));
+    busyCycles = 0;
+    windowStartMs += elapsed;
+}
+
+/**
+ * Run one pending event handler, or sleep until an interrupt when idle.
+ * Called from the main loop.
+ */
+void SchedulerDispatch(void)
+{
+    uint32_t events;
+    uint8_t event;
+    uint32_t now;
+
+    __disable_irq();
+    now = DWT->CYCCNT;
+    busyCycles += now - wakeCycles;
+    wakeCycles = now;
+    SchedulerUpdateLoad();
+
+    if (pending == 0) {
+        __WFI();
+        wakeCycles = DWT->CYCCNT;
+    }
+    events = pending;
+    // Lowest pending event number first
+    event = (uint8_t)__CLZ(__RBIT(events));
+    if (events != 0)
+        pending = events & ~(1UL << event);
+    __enable_irq();
+
+    if ((events != 0) && (event < SCHEDULER_EVENTS) && (handlers[event] != NULL))
+        handlers[event]();
+}
+
+/**
+ * CPU load over the last SCHEDULER_LOAD_WINDOW_MS, per mille
+ */
+uint16_t SchedulerGetLoad(void)
+{
+    return load;
+}
+
+/**
+ * Record a latency sample in microseconds
+ */
+void SchedulerLatencyProbe(uint8_t probe, uint32_t us)
+{
+    if (probe >= SCHEDULER_PROBES)
+        return;
+
+    if (us > latency.windowMax[probe])
+        latency.windowMax[probe] = (uint16_t)us;
+    if (us > latency.peak[probe])
+        latency.peak[probe] = (uint16_t)us;
+}
+
+/**
+ * Copy the latency maxima and start a new window
+ */
+void SchedulerTakeLatency(SchedulerLatency *out)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    for (uint8_t i = 0; i < SCHEDULER_PROBES; i++) {
+        out->windowMax[i] = latency.windowMax[i];
+        out->peak[i] = latency.peak[i];
+        latency.windowMax[i] = 0;
+    }
+    __set_PRIMASK(primask);
+}
@@ -0,0 +1,42 @@
+#ifndef _SCHEDULER_H
+#define _SCHEDULER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Events, numbered by priority (0 runs first). Posted from interrupts,
+ * handled run-to-completion in thread mode.
+ */
+#define SCHEDULER_EVENT_SAMPLE          0   // TIM2 acquisition tick
+#define SCHEDULER_EVENT_MOTOR           1   // Limit switch, driver fault, planner refill
+#define SCHEDULER_EVENT_COMMAND         2   // USART1 RX idle / DMA half or full, RX errors
+#define SCHEDULER_EVENT_HOUSEKEEPING    3   // SysTick 1 ms, periodic reports
+#define SCHEDULER_EVENT_BACKGROUND      4   // Long computations split into steps, re-posted per step
+#define SCHEDULER_EVENTS                5
+
+#define SCHEDULER_LOAD_WINDOW_MS        1000    // CPU load averaging window
+
+/**
+ * Latency probe points, microseconds from the TIM2 update event
+ */
+#define SCHEDULER_PROBE_TICK_IRQ        0   // TIM2 interrupt entry
+#define SCHEDULER_PROBE_SAMPLE          1   // Sample event handler start
+#define SCHEDULER_PROBE_READ            2   // SPI sequence of the sample complete
+#define SCHEDULER_PROBES                3
+
+typedef void (*SchedulerHandler)(void);
+
+typedef struct {
+    uint16_t windowMax[SCHEDULER_PROBES];   // Since the last SchedulerTakeLatency()
+    uint16_t peak[SCHEDULER_PROBES];        // Since boot
+} SchedulerLatency;
+
+void SchedulerInit(void);
+void SchedulerRegister(uint8_t event, SchedulerHandler handler);
+void SchedulerPost(uint8_t event);
+void SchedulerDispatch(void);
+uint16_t SchedulerGetLoad(void);
+void SchedulerLatencyProbe(uint8_t probe, uint32_t us);
+void SchedulerTakeLatency(SchedulerLatency *out);
+#endif
@@ -0,0 +1,180 @@
+/* Stats.c
+ * Windowed statistics of the raw channels for condition monitoring: mean,
+ * RMS about the mean, min, max and peak-to-peak per window instead of the
+ * sample stream.
+ *
+ * Every sample adds its offset from the first value of the window to a
+ * 64-bit sum and sum of squares, so the per-sample cost is a few integer
+ * operations per channel and no precision is lost to the DC level (gravity
+ * on the accelerometers). A closed window is copied and finished from the
+ * housekeeping handler, where the divisions and the square root run.
+ */
+
+#include "Stats.h"
+#include "ConfigStore.h"
+#include "Protocol.h"
+#include "Link.h"
+#include "Cordic.h"
+#include "SampleRate.h"
+#include "main.h"
+
+#define STATS_QUALITY_BITS  (SCH_QUALITY_RATE1_X | SCH_QUALITY_RATE1_Y | SCH_QUALITY_RATE1_Z | \
+                             SCH_QUALITY_ACC1_X | SCH_QUALITY_ACC1_Y | SCH_QUALITY_ACC1_Z | SCH_QUALITY_TEMP)
+
+typedef struct {
+    int64_t  sum;               // Sum of (value - ref)
+    uint64_t sumSquares;        // Sum of (value - ref)^2
+    int32_t  ref;               // First value of the window
+    int32_t  min;
+    int32_t  max;
+} StatsAccumulator;
+
+typedef struct {
+    StatsAccumulator channel[STATS_CHANNELS];
+    uint32_t firstSample;
+    uint32_t samples;
+    uint32_t startMs;
+    uint32_t durationMs;
+    uint16_t sampleRate;
+    uint16_t skipped;
+} StatsWindow;
+
+static StatsWindow active;              // Sample handler
+static StatsWindow pending;             // Closed window, handed to StatsSend()
+static volatile bool pendingReady = false;
+static bool running = false;
+
+void StatsLoadDefaults(StatsParams *params)
+{
+    params->windowSamples = STATS_DEFAULT_SAMPLES;
+    params->windowMs      = STATS_DEFAULT_PERIOD_MS;
+}
+
+static void StatsStart(uint32_t sampleCounter)
+{
+    active.firstSample = sampleCounter;
+    active.samples = 0;
+    active.skipped = 0;
+    active.startMs = HAL_GetTick();
+    active.sampleRate = (uint16_t)SampleRateGet();
+}
+
+/**
+ * Add one sample, close the window at its limit. Called from the sample
+ * handler.
+ */
+void StatsUpdate(const SCHRawData *data, uint32_t sampleCounter)
+{
+    const StatsParams *params = &appConfig.stats;
+    int32_t values[STATS_CHANNELS];
+    uint32_t now;
+
+    if ((appConfig.streams & STREAM_STATS) == 0) {
+        running = false;
+        return;
+    }
+    if (!running) {
+        StatsStart(sampleCounter);
+        running = true;
+    }
+
+    if (data->quality & STATS_QUALITY_BITS) {
+        if (active.skipped < UINT16_MAX)
+            active.skipped++;
+    } else {
+        values[STATS_RATE1_X] = data->rate1Raw[AXIS_X];
+        values[STATS_RATE1_Y] = data->rate1Raw[AXIS_Y];
+        values[STATS_RATE1_Z] = data->rate1Raw[AXIS_Z];
+        values[STATS_ACC1_X]  = data->acc1Raw[AXIS_X];
+        values[STATS_ACC1_Y]  = data->acc1Raw[AXIS_Y];
+        values[STATS_ACC1_Z]  = data->acc1Raw[AXIS_Z];
+        values[STATS_TEMP]    = data->tempRaw;
+
+        for (int i = 0; i < STATS_CHANNELS; i++)
+        {
+            StatsAccumulator *acc = &active.channel[i];
+            int32_t value = values[i];
+            int32_t offset;
+
+            if (active.samples == 0) {
+                acc->ref = value;
+                acc->min = value;
+                acc->max = value;
+                acc->sum = 0;
+                acc->sumSquares = 0;
+            }
+
+            offset = value - acc->ref;
+            acc->sum += offset;
+            acc->sumSquares += (uint64_t)((int64_t)offset * offset);
+            if (value < acc->min)
+                acc->min = value;
+            if (value > acc->max)
+                acc->max = value;
+        }
+        active.samples++;
+    }
+
+    now = HAL_GetTick();
+    if (((params->windowSamples == 0) || ((active.samples + active.skipped) < params->windowSamples)) &&
+        ((params->windowMs == 0) || ((now - active.startMs) < params->windowMs)) &&
+        (active.samples < STATS_MAX_SAMPLES))
+        return;
+
+    active.durationMs = now - active.startMs;
+    // A window not yet sent is kept, the host sees the gap in firstSample
+    if (!pendingReady) {
+        pending = active;
+        __DMB();
+        pendingReady = true;
+    }
+    StatsStart(sampleCounter + 1);
+}
+
+/**
+ * Finish and send a closed window. Called from the housekeeping handler.
+ */
+void StatsSend(void)
+{
+    PktStats pkt;
+    uint32_t n;
+
+    if (!pendingReady)
+        return;
+
+    n = pending.samples;
+    pkt.firstSample = pending.firstSample;
+    pkt.samples = n;
+    pkt.durationMs = pending.durationMs;
+    pkt.sampleRate = pending.sampleRate;
+    pkt.skipped = pending.skipped;
+
+    for (int i = 0; i < STATS_CHANNELS; i++)
+    {
+        const StatsAccumulator *acc = &pending.channel[i];
+        StatsChannel *out = &pkt.channel[i];
+        int64_t meanQ8, varianceQ16;
+
+        if (n == 0) {
+            out->mean = 0;
+            out->rms = 0;
+            out->min = 0;
+            out->max = 0;
+            out->peakToPeak = 0;
+            continue;
+        }
+
+        // E[d^2] - E[d]^2 in Q16, the remainder keeps the fraction of E[d^2]
+        meanQ8 = (acc->sum * 256) / (int64_t)n;
+        varianceQ16 = (int64_t)(((acc->sumSquares / n) << 16) + (((acc->sumSquares % n) << 16) / n)) - meanQ8 * meanQ8;
+
+        out->mean = (int32_t)(((int64_t)acc->ref * 256) + meanQ8);
+        out->rms = (varianceQ16 > 0) ? CordicSqrt((uint64_t)varianceQ16) : 0;
+        out->min = acc->min;
+        out->max = acc->max;
+        out->peakToPeak = (uint32_t)(acc->max - acc->min);
+    }
+
+    pendingReady = false;
+    LinkSend(PKT_STATS, &pkt, sizeof(pkt));
+}
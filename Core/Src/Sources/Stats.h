@@ -0,0 +1,62 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "SCHSensor.h"
+
+#define STATS_MAX_SAMPLES           (1UL << 20)     // Window cap, keeps the sums of squares in 64 bits
+
+/**
+ * Default window: one second, independent of the sample rate
+ */
+#define STATS_DEFAULT_SAMPLES       0
+#define STATS_DEFAULT_PERIOD_MS     1000
+
+/**
+ * Channels in PktStats, raw sensor counts
+ */
+typedef enum {
+    STATS_RATE1_X = 0,
+    STATS_RATE1_Y,
+    STATS_RATE1_Z,
+    STATS_ACC1_X,
+    STATS_ACC1_Y,
+    STATS_ACC1_Z,
+    STATS_TEMP,
+    STATS_CHANNELS
+} StatsChannelId;
+
+/**
+ * Window parameters, part of the persistent configuration. A window closes
+ * at whichever limit is reached first, 0 = limit not used.
+ */
+typedef struct {
+    uint32_t windowSamples;     // Samples per window, up to STATS_MAX_SAMPLES
+    uint32_t windowMs;          // Window length, ms
+} StatsParams;
+
+typedef struct {
+    int32_t  mean;              // Q8 LSB
+    uint32_t rms;               // Q8 LSB, RMS about the mean (standard deviation)
+    int32_t  min;               // LSB
+    int32_t  max;               // LSB
+    uint32_t peakToPeak;        // LSB
+} StatsChannel;
+
+/**
+ * PKT_STATS payload, one per window (STREAM_STATS)
+ */
+typedef struct {
+    uint32_t firstSample;       // Sample counter of the first sample in the window
+    uint32_t samples;           // Samples in the statistics
+    uint32_t durationMs;
+    uint16_t sampleRate;        // Hz
+    uint16_t skipped;           // Samples left out for a frame error
+    StatsChannel channel[STATS_CHANNELS];
+} PktStats;
+
+void StatsLoadDefaults(StatsParams *params);
+void StatsUpdate(const SCHRawData *data, uint32_t sampleCounter);
+void StatsSend(void);
+#endif
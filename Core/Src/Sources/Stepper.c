@@ -0,0 +1,817 @@
+/* Stepper.c
+ * Step/direction driver on TIM4 channel 1 (PB6 = MOTOR_STEP).
+ *
+ * TIM4 runs in PWM mode 1 with ARR and CCR1 preload. Every timer period
+ * starts with a CCR1 ticks wide STEP pulse (CCR1 = 0 gives an idle period),
+ * so pulses are generated in hardware without jitter from other interrupts.
+ * Step intervals longer than the 16-bit timer are split into one pulse period
+ * followed by idle periods.
+ *
+ * Step intervals come either from a constant rate (StepperSetRate()) or from
+ * a queue of constant-interval segments prepared by the motion planner. They
+ * are turned into timer periods in one of two ways:
+ *
+ *  - Interrupt mode: the update interrupt counts the step that starts with the
+ *    new period and preloads ARR/CCR1 for the period after it.
+ *  - DMA mode (segment queue only, see StepperSetDma()): periods are written
+ *    to a circular buffer of ARR/RCR/CCR1 triplets that DMA1 channel 7 bursts
+ *    into TIM4 through DMAR on every update event. The CPU refills one half of
+ *    the buffer on the half/complete transfer interrupts. The position and
+ *    the step rate are derived from the DMA counter, the rate from a per
+ *    entry table kept next to the triplets. A direction change ends the DMA run on
+ *    idle periods and restarts it with the new direction.
+ *
+ * Velocity planning runs in the background (Motion.c), the interrupts turn
+ * queued intervals into periods with StepperNextPeriod(): a segment fetch,
+ * splitting of long intervals and DIR handling. The TIM4 update interrupt
+ * does this for one period. The DMA1 channel 7 half/complete interrupt
+ * does it for the STEPPER_DMA_HALF (32) periods of one buffer half, plus a
+ * rate division per interval change, an estimated worst case of about
+ * 3000 cycles (~50 us at 64 MHz) every 32 periods. Both run at the motor
+ * priority, below the acquisition tick.
+ */
+
+#include "Stepper.h"
+#include "SCHsensor.h"
+#include "tim.h"
+#include "Scheduler.h"
+#include "Critical.h"
+#include "Trace.h"
+
+#define STEPPER_PERIOD_STEP         0   // Period starting with a pulse
+#define STEPPER_PERIOD_IDLE         1   // Period without pulse
+#define STEPPER_PERIOD_DIR          2   // DIR has to change before the next pulse
+#define STEPPER_PERIOD_STOP         3   // Nothing more to step out
+
+#define STEPPER_DMA_HALF            (STEPPER_DMA_PERIODS / 2)
+#define STEPPER_DMA_WORDS           3   // ARR, RCR (reserved on TIM4, write ignored), CCR1
+#define STEPPER_DMA_BURST_BASE      11  // DCR.DBA: ARR is register 11 counted from CR1
+
+static volatile int32_t position = 0;
+static volatile int32_t targetInterval = 0;     // Signed ticks per step, 0 = stop
+static volatile bool running = false;
+static volatile bool queueMode = false;        // Intervals come from the segment queue
+static volatile int32_t activeInterval = 0;     // Interval of the last generated step
+static volatile int32_t outputInterval = 0;     // Interrupt mode: interval of the period on STEP, 0 = idle
+static volatile uint32_t underruns = 0;
+static bool enabled = false;
+static bool dmaEnabled = false;
+static volatile bool faulted = false;          // Latched until StepperRearm()
+static volatile bool faultEvent = false;       // Fault not yet reported
+static StepperFault fault;
+
+static StepperSegment queue[STEPPER_QUEUE_SIZE];
+static volatile uint8_t queueHead = 0;          // Written by StepperQueuePush()
+static volatile uint8_t queueTail = 0;          // Written by the step interrupts
+
+// Period generator, used by the step interrupts only while running
+static uint32_t remainingTicks = 0;             // Ticks of the current step interval not yet loaded
+static int8_t activeDir = 1;                    // Direction on the DIR pin
+static int8_t pendingDir = 1;                   // Direction of the step waiting for a DIR change
+static bool loadedPulse = false;                // Last generated period starts with a pulse
+static int32_t segmentInterval = 0;             // Segment being stepped out
+static uint16_t segmentSteps = 0;
+static bool segmentLast = false;
+static bool starved = false;
+static int32_t periodInterval = 0;              // Step interval of the last generated period, 0 = idle
+static int32_t loadedInterval = 0;              // Interrupt mode: same for the preloaded period
+
+// DMA mode
+static uint16_t dmaBuffer[STEPPER_DMA_PERIODS][STEPPER_DMA_WORDS];
+static uint8_t dmaPulses[STEPPER_DMA_PERIODS];  // Pulses in the half up to and including the entry
+static uint32_t dmaHalfStart[2];                // Run pulse count before each half
+static uint32_t dmaFilledPulses;                // Pulses written to the buffer in this run
+static int32_t dmaRunPosition;                  // Position at the start of the run
+static volatile bool dmaActive = false;
+static bool dmaEnding;                          // Run ends, remaining periods are idle
+static bool dmaRestart;                         // Restart with pendingDir once the run has ended
+static int8_t dmaIdleHalf;                      // Half holding idle periods only, -1 = none
+static uint16_t dmaRates[STEPPER_DMA_PERIODS];  // Step rate of each entry, steps/s, 0 = idle
+static uint16_t dmaHalfEndRate[2];              // Last entry of each half as played, saved by the refill
+static bool dmaRefilled[2];                     // Half holds periods the DMA has not reached yet
+static int32_t dmaRateInterval;                 // Cache for the rate division
+static uint16_t dmaRateValue;
+
+static void StepperWriteDir(int8_t dir)
+{
+    HAL_GPIO_WritePin(MOTOR_DIR_GPIO_Port, MOTOR_DIR_Pin, (dir > 0) ? STEPPER_DIR_POSITIVE : STEPPER_DIR_NEGATIVE);
+    activeDir = dir;
+}
+
+/**
+ * Next step interval from the segment queue. Returns false on underrun, when
+ * the planner has not delivered the next segment in time.
+ */
+static bool StepperQueueNext(int32_t *interval)
+{
+    if (segmentSteps == 0) {
+        uint8_t tail = queueTail;
+
+        if (tail == queueHead) {
+            *interval = 0;
+            return segmentLast;
+        }
+
+        segmentInterval = queue[tail].interval;
+        segmentSteps = queue[tail].steps;
+        segmentLast = (queue[tail].flags & STEPPER_SEGMENT_LAST) != 0;
+        queueTail = (tail + 1) & (STEPPER_QUEUE_SIZE - 1);
+
+        if (segmentSteps == 0) {
+            *interval = 0;
+            return segmentLast;
+        }
+    }
+
+    segmentSteps--;
+    *interval = segmentInterval;
+    return true;
+}
+
+/**
+ * @brief Generate the next timer period.
+ *
+ * A new step interval is only started at the end of the current one. A
+ * direction change is only reported after an idle period, so DIR always has
+ * setup time before the next pulse.
+ *
+ * @param ticks - period length in timer ticks
+ * @return STEPPER_PERIOD_xxx
+ */
+static uint8_t StepperNextPeriod(uint32_t *ticks)
+{
+    bool pulse = false;
+    uint32_t chunk;
+
+    if (remainingTicks == 0) {
+        int32_t interval = targetInterval;
+        int8_t dir;
+        uint32_t magnitude;
+
+        if (queueMode && !StepperQueueNext(&interval)) {
+            // Planner underrun: hold STEP low and retry, no step is lost
+            if (!starved)
+                underruns++;
+            starved = true;
+            loadedPulse = false;
+            periodInterval = 0;
+            *ticks = STEPPER_UNDERRUN_TICKS;
+            return STEPPER_PERIOD_IDLE;
+        }
+        starved = false;
+
+        dir = (interval < 0) ? -1 : 1;
+        magnitude = (uint32_t)((interval < 0) ? -interval : interval);
+
+        periodInterval = 0;
+        if (magnitude == 0) {
+            if (!loadedPulse)
+                return STEPPER_PERIOD_STOP;
+            loadedPulse = false;
+            *ticks = STEPPER_DIR_SETUP_TICKS;
+            return STEPPER_PERIOD_IDLE;
+        }
+
+        if (dir != activeDir) {
+            if (queueMode)
+                segmentSteps++;     // Step it out after the direction change
+            pendingDir = dir;
+            if (!loadedPulse)
+                return STEPPER_PERIOD_DIR;
+            loadedPulse = false;
+            *ticks = STEPPER_DIR_SETUP_TICKS;
+            return STEPPER_PERIOD_IDLE;
+        }
+
+        remainingTicks = magnitude;
+        activeInterval = interval;
+        periodInterval = interval;
+        pulse = true;
+    }
+
+    // Split long intervals so that no period is shorter than half the timer range
+    if (remainingTicks > 0x10000UL)
+        chunk = (remainingTicks > 0x20000UL) ? 0x10000UL : (remainingTicks >> 1);
+    else
+        chunk = remainingTicks;
+    remainingTicks -= chunk;
+
+    loadedPulse = pulse;
+    *ticks = chunk;
+
+    return pulse ? STEPPER_PERIOD_STEP : STEPPER_PERIOD_IDLE;
+}
+
+/**
+ * Preload an idle period
+ */
+static void StepperLoadIdle(uint32_t ticks)
+{
+    TIM4->ARR = ticks - 1;
+    TIM4->CCR1 = 0;
+    loadedPulse = false;
+    loadedInterval = 0;
+}
+
+/**
+ * Interrupt mode: preload ARR/CCR1 for the period after the one that is starting now
+ */
+static void StepperLoadNext(void)
+{
+    uint32_t ticks = 0;
+    uint8_t kind = StepperNextPeriod(&ticks);
+
+    if (kind == STEPPER_PERIOD_DIR) {
+        // Current period is idle, DIR gets its whole length as setup time
+        StepperWriteDir(pendingDir);
+        kind = StepperNextPeriod(&ticks);
+    }
+
+    if (kind == STEPPER_PERIOD_STOP) {
+        // Current period is idle, stop here with STEP low
+        TIM4->CR1 &= ~TIM_CR1_CEN;
+        TIM4->DIER &= ~TIM_DIER_UIE;
+        running = false;
+        outputInterval = 0;
+        return;
+    }
+
+    TIM4->ARR = ticks - 1;
+    TIM4->CCR1 = (kind == STEPPER_PERIOD_STEP) ? STEPPER_PULSE_TICKS : 0;
+    loadedInterval = periodInterval;
+}
+
+/**
+ * DMA mode: step rate of a generated period, the division only runs when
+ * the interval changes
+ */
+static uint16_t StepperDmaRateOf(int32_t interval)
+{
+    if (interval != dmaRateInterval) {
+        uint32_t magnitude = (uint32_t)((interval < 0) ? -interval : interval);
+
+        dmaRateInterval = interval;
+        dmaRateValue = (magnitude == 0) ? 0 : (uint16_t)(STEPPER_TICK_HZ / magnitude);
+    }
+
+    return dmaRateValue;
+}
+
+/**
+ * DMA mode: generate the periods of one buffer half
+ */
+static void StepperDmaFill(uint8_t half)
+{
+    uint16_t first = half * STEPPER_DMA_HALF;
+    uint8_t pulses = 0;
+    bool idleOnly = dmaEnding;
+
+    // The DMA has just played the last entry of this half
+    dmaHalfEndRate[half] = dmaRates[first + STEPPER_DMA_HALF - 1];
+
+    for (uint16_t i = first; i < (first + STEPPER_DMA_HALF); i++)
+    {
+        uint32_t ticks = STEPPER_UNDERRUN_TICKS;
+        uint8_t kind = STEPPER_PERIOD_IDLE;
+        uint16_t rate = 0;
+
+        if (!dmaEnding) {
+            kind = StepperNextPeriod(&ticks);
+            if ((kind == STEPPER_PERIOD_DIR) || (kind == STEPPER_PERIOD_STOP)) {
+                dmaEnding = true;
+                dmaRestart = (kind == STEPPER_PERIOD_DIR);
+                kind = STEPPER_PERIOD_IDLE;
+                ticks = STEPPER_UNDERRUN_TICKS;
+            } else {
+                rate = StepperDmaRateOf(periodInterval);
+            }
+        }
+
+        if (kind == STEPPER_PERIOD_STEP)
+            pulses++;
+
+        dmaBuffer[i][0] = (uint16_t)(ticks - 1);
+        dmaBuffer[i][1] = 0;
+        dmaBuffer[i][2] = (kind == STEPPER_PERIOD_STEP) ? STEPPER_PULSE_TICKS : 0;
+        dmaPulses[i] = pulses;
+        dmaRates[i] = rate;
+    }
+
+    dmaRefilled[half] = true;
+    dmaRefilled[half ^ 1] = false;
+
+    dmaHalfStart[half] = dmaFilledPulses;
+    dmaFilledPulses += pulses;
+
+    if (idleOnly)
+        dmaIdleHalf = (int8_t)half;
+}
+
+/**
+ * Position during a DMA run. Periods are counted when DMA has written them to
+ * the timer, which may lead the STEP output by the periods held in the preload
+ * and shadow registers. Called with interrupts disabled.
+ */
+static uint16_t StepperDmaIndex(void)
+{
+    uint32_t transferred = (STEPPER_DMA_PERIODS * STEPPER_DMA_WORDS) - __HAL_DMA_GET_COUNTER(htim4.hdma[TIM_DMA_ID_UPDATE]);
+
+    return (uint16_t)(transferred / STEPPER_DMA_WORDS);
+}
+
+static int32_t StepperDmaPosition(void)
+{
+    uint16_t index = StepperDmaIndex();
+    uint8_t half = (index < STEPPER_DMA_HALF) ? 0 : 1;
+    uint32_t pulses = dmaHalfStart[half];
+
+    // The half the DMA is in is never refilled before the DMA has left it
+    if (index > (half * STEPPER_DMA_HALF))
+        pulses += dmaPulses[index - 1];
+
+    return dmaRunPosition + activeDir * (int32_t)pulses;
+}
+
+/**
+ * Step rate of the last entry written to the timer during a DMA run, the
+ * entry that StepperDmaPosition() counts up to. Called with interrupts
+ * disabled.
+ */
+static int32_t StepperDmaRate(void)
+{
+    uint16_t index = StepperDmaIndex();
+    uint8_t half = (index < STEPPER_DMA_HALF) ? 0 : 1;
+    uint8_t other = half ^ 1;
+    uint16_t rate;
+
+    if (index > (half * STEPPER_DMA_HALF))
+        rate = dmaRates[index - 1];
+    else if (dmaRefilled[other])
+        rate = dmaHalfEndRate[other];
+    else
+        rate = dmaRates[other * STEPPER_DMA_HALF + STEPPER_DMA_HALF - 1];
+
+    return activeDir * (int32_t)rate;
+}
+
+/**
+ * Stop DMA and timer
+ */
+static void StepperDmaEnd(void)
+{
+    TIM4->CR1 &= ~TIM_CR1_CEN;
+    TIM4->DIER &= ~TIM_DIER_UDE;
+    HAL_DMA_Abort(htim4.hdma[TIM_DMA_ID_UPDATE]);
+    TIM4->DCR = 0;
+    dmaActive = false;
+}
+
+/**
+ * Start the timer from stop with the given direction. The first period is
+ * idle and gives DIR its setup time.
+ */
+static void StepperStart(int8_t dir)
+{
+    remainingTicks = 0;
+    outputInterval = 0;
+    StepperWriteDir(dir);
+
+    TIM4->CNT = 0;
+    StepperLoadIdle(STEPPER_DIR_SETUP_TICKS);
+    TIM4->EGR = TIM_EGR_UG;         // Load shadow registers, URS keeps interrupt and DMA quiet
+
+    if (queueMode && dmaEnabled) {
+        dmaRunPosition = position;
+        dmaFilledPulses = 0;
+        dmaEnding = false;
+        dmaRestart = false;
+        dmaIdleHalf = -1;
+        dmaRateInterval = 0;
+        dmaRateValue = 0;
+        StepperDmaFill(0);
+        StepperDmaFill(1);
+        // Nothing has been played before the first entry
+        dmaHalfEndRate[0] = 0;
+        dmaHalfEndRate[1] = 0;
+
+        dmaActive = true;
+        TIM4->DCR = ((STEPPER_DMA_WORDS - 1) << TIM_DCR_DBL_Pos) | (STEPPER_DMA_BURST_BASE << TIM_DCR_DBA_Pos);
+        HAL_DMA_Start_IT(htim4.hdma[TIM_DMA_ID_UPDATE], (uint32_t)dmaBuffer, (uint32_t)&TIM4->DMAR,
+                         STEPPER_DMA_PERIODS * STEPPER_DMA_WORDS);
+        TIM4->DIER |= TIM_DIER_UDE;
+    }
+    else {
+        StepperLoadNext();
+        TIM4->SR = ~TIM_SR_UIF;
+        TIM4->DIER |= TIM_DIER_UIE;
+    }
+
+    running = true;
+    TIM4->CR1 |= TIM_CR1_CEN;
+}
+
+/**
+ * DMA half/complete transfer: the half the DMA just left is refilled
+ */
+static void StepperDmaHalfDone(uint8_t half)
+{
+    if (!dmaActive)
+        return;
+
+    // The idle half after the last pulse has been played out
+    if (dmaIdleHalf == (int8_t)half) {
+        StepperDmaEnd();
+        position = dmaRunPosition + activeDir * (int32_t)dmaFilledPulses;
+        if (dmaRestart)
+            StepperStart(pendingDir);
+        else
+            running = false;
+        return;
+    }
+
+    StepperDmaFill(half);
+    TraceWrite(TRACE_STEP_DMA, half);
+}
+
+static void StepperDmaHalfCallback(DMA_HandleTypeDef *hdma)
+{
+    (void)hdma;
+    StepperDmaHalfDone(0);
+}
+
+static void StepperDmaCpltCallback(DMA_HandleTypeDef *hdma)
+{
+    (void)hdma;
+    StepperDmaHalfDone(1);
+}
+
+/**
+ * Set up TIM4 for step generation, driver disabled
+ */
+void StepperInit(void)
+{
+    HAL_GPIO_WritePin(MOTOR_EN_GPIO_Port, MOTOR_EN_Pin, STEPPER_EN_INACTIVE);
+    StepperWriteDir(1);
+    enabled = false;
+
+    TIM4->CR1 &= ~TIM_CR1_CEN;
+    TIM4->CR1 |= TIM_CR1_URS;       // Only counter overflow raises the update interrupt / DMA request
+    TIM4->DIER &= ~(TIM_DIER_UIE | TIM_DIER_UDE);
+    StepperLoadIdle(STEPPER_DIR_SETUP_TICKS);
+    TIM4->EGR = TIM_EGR_UG;
+    TIM4->SR = ~TIM_SR_UIF;
+    TIM4->CCER |= TIM_CCER_CC1E;
+
+    htim4.hdma[TIM_DMA_ID_UPDATE]->XferHalfCpltCallback = StepperDmaHalfCallback;
+    htim4.hdma[TIM_DMA_ID_UPDATE]->XferCpltCallback = StepperDmaCpltCallback;
+
+    position = 0;
+    targetInterval = 0;
+    running = false;
+
+    // Driver already in fault at boot, no edge will follow
+    if (HAL_GPIO_ReadPin(MOTOR_FLT_GPIO_Port, MOTOR_FLT_Pin) == STEPPER_FLT_ACTIVE)
+        StepperFaultIrq();
+}
+
+/**
+ * Driver enable output. Disabling stops stepping immediately, enabling is
+ * ignored while a driver fault is latched.
+ */
+void StepperEnable(bool enable)
+{
+    if (enable && faulted)
+        return;
+    if (!enable)
+        StepperStop();
+
+    HAL_GPIO_WritePin(MOTOR_EN_GPIO_Port, MOTOR_EN_Pin, enable ? STEPPER_EN_ACTIVE : STEPPER_EN_INACTIVE);
+    enabled = enable;
+}
+
+bool StepperIsEnabled(void)
+{
+    return enabled;
+}
+
+bool StepperIsFaulted(void)
+{
+    return faulted;
+}
+
+/**
+ * @brief Fetch a fault not yet reported.
+ *
+ * @return true once per latched fault
+ */
+bool StepperGetFaultEvent(StepperFault *faultOut)
+{
+    uint32_t basepri;
+
+    if (!faultEvent)
+        return false;
+
+    basepri = CriticalEnter();
+    *faultOut = fault;
+    faultEvent = false;
+    CriticalExit(basepri);
+
+    return true;
+}
+
+/**
+ * @brief Clear a latched fault and enable the driver again.
+ *
+ * @return SCH_OK, SCH_ERR_OTHER while the driver still reports the fault
+ */
+int32_t StepperRearm(void)
+{
+    if (HAL_GPIO_ReadPin(MOTOR_FLT_GPIO_Port, MOTOR_FLT_Pin) == STEPPER_FLT_ACTIVE)
+        return SCH_ERR_OTHER;
+
+    faulted = false;
+    StepperEnable(true);
+
+    return SCH_OK;
+}
+
+/**
+ * MOTOR_FLT falling edge, called from EXTI9_5_IRQHandler(). Stops stepping
+ * and releases EN before anything else.
+ */
+void StepperFaultIrq(void)
+{
+    int32_t rate;
+
+    HAL_GPIO_WritePin(MOTOR_EN_GPIO_Port, MOTOR_EN_Pin, STEPPER_EN_INACTIVE);
+    rate = StepperGetRate();
+    StepperStop();
+    enabled = false;
+
+    if (!faulted) {
+        fault.timeMs = HAL_GetTick();
+        fault.position = StepperGetPosition();
+        fault.rate = rate;
+        faultEvent = true;
+        TraceWrite(TRACE_MOTOR_FAULT, (uint16_t)fault.position);
+        TraceFreeze();
+        SchedulerPost(SCHEDULER_EVENT_MOTOR);
+    }
+    faulted = true;
+}
+
+/**
+ * Feed queued segments through DMA instead of the update interrupt. Takes
+ * effect on the next start from stop.
+ */
+void StepperSetDma(bool enable)
+{
+    dmaEnabled = enable;
+}
+
+/**
+ * @brief Set the step interval.
+ *
+ * Takes effect at the end of the current step interval.
+ *
+ * @param ticks - signed STEPPER_TICK_HZ ticks per step, sign = direction, 0 = stop
+ * @return SCH_OK or SCH_ERR_INVALID_PARAM when outside the step rate range,
+ *         SCH_ERR_OTHER when the driver is disabled or a DMA run is active
+ */
+int32_t StepperSetInterval(int32_t ticks)
+{
+    uint32_t magnitude = (uint32_t)((ticks < 0) ? -ticks : ticks);
+    uint32_t basepri;
+
+    if ((magnitude != 0) &&
+        ((magnitude < (STEPPER_TICK_HZ / STEPPER_MAX_RATE)) || (magnitude > STEPPER_MAX_INTERVAL)))
+        return SCH_ERR_INVALID_PARAM;
+
+    if ((magnitude != 0) && (!enabled || dmaActive))
+        return SCH_ERR_OTHER;
+
+    // The step interrupts may stop the timer between the check and the start
+    basepri = CriticalEnter();
+
+    if (dmaActive) {
+        // Stop during a DMA run: drop the queue, the run ends after the buffered periods
+        queueTail = queueHead;
+        segmentSteps = 0;
+        segmentLast = true;
+    }
+    else {
+        queueMode = false;
+        queueTail = queueHead;
+        targetInterval = ticks;
+        if ((ticks != 0) && !running)
+            StepperStart((ticks < 0) ? -1 : 1);
+    }
+
+    CriticalExit(basepri);
+
+    return SCH_OK;
+}
+
+/**
+ * @brief Set the step rate.
+ *
+ * @param stepsPerSecond - signed step rate, 0 = stop after the current step interval
+ * @return see StepperSetInterval()
+ */
+int32_t StepperSetRate(int32_t stepsPerSecond)
+{
+    uint32_t rate = (uint32_t)((stepsPerSecond < 0) ? -stepsPerSecond : stepsPerSecond);
+    int32_t ticks;
+
+    if (rate > STEPPER_MAX_RATE)
+        return SCH_ERR_INVALID_PARAM;
+    if (rate == 0)
+        return StepperSetInterval(0);
+
+    ticks = (int32_t)((STEPPER_TICK_HZ + rate / 2) / rate);
+
+    return StepperSetInterval((stepsPerSecond < 0) ? -ticks : ticks);
+}
+
+/**
+ * Current step rate (steps/s)
+ */
+int32_t StepperGetRate(void)
+{
+    StepperTag tag;
+
+    StepperGetTag(&tag);
+    return tag.rate;
+}
+
+/**
+ * Direction currently set on the DIR pin, +1 = increasing position
+ */
+int8_t StepperGetDirection(void)
+{
+    return activeDir;
+}
+
+/**
+ * Stop immediately, a pulse in progress is cut short and STEP driven low
+ */
+void StepperStop(void)
+{
+    uint32_t basepri = CriticalEnter();
+
+    if (dmaActive) {
+        position = StepperDmaPosition();
+        StepperDmaEnd();
+    }
+
+    TIM4->CR1 &= ~TIM_CR1_CEN;
+    TIM4->DIER &= ~(TIM_DIER_UIE | TIM_DIER_UDE);
+    StepperLoadIdle(STEPPER_DIR_SETUP_TICKS);
+    TIM4->EGR = TIM_EGR_UG;
+    TIM4->SR = ~TIM_SR_UIF;
+
+    targetInterval = 0;
+    activeInterval = 0;
+    outputInterval = 0;
+    remainingTicks = 0;
+    segmentSteps = 0;
+    segmentLast = false;
+    queueMode = false;
+    queueTail = queueHead;
+    running = false;
+
+    CriticalExit(basepri);
+}
+
+/**
+ * @brief Append a segment to the queue.
+ *
+ * @return false when the queue is full
+ */
+bool StepperQueuePush(const StepperSegment *segment)
+{
+    uint8_t head = queueHead;
+    uint8_t next = (head + 1) & (STEPPER_QUEUE_SIZE - 1);
+
+    if (next == queueTail)
+        return false;
+
+    queue[head] = *segment;
+    queueHead = next;
+
+    return true;
+}
+
+uint16_t StepperQueueFree(void)
+{
+    return (uint16_t)((queueTail - queueHead - 1) & (STEPPER_QUEUE_SIZE - 1));
+}
+
+/**
+ * Step out the segment queue, starts the timer when stopped. The first
+ * segment should already be queued.
+ */
+int32_t StepperQueueStart(void)
+{
+    uint32_t basepri;
+
+    if (!enabled)
+        return SCH_ERR_OTHER;
+
+    basepri = CriticalEnter();
+
+    targetInterval = 0;
+    segmentLast = false;
+    queueMode = true;
+    if (!running)
+        StepperStart(((queueTail != queueHead) && (queue[queueTail].interval < 0)) ? -1 : 1);
+
+    CriticalExit(basepri);
+
+    return SCH_OK;
+}
+
+/**
+ * Segments that were not queued in time
+ */
+uint32_t StepperGetUnderruns(void)
+{
+    return underruns;
+}
+
+bool StepperIsRunning(void)
+{
+    return running;
+}
+
+/**
+ * Intervals come from the segment queue (motion planner) instead of a constant rate
+ */
+bool StepperIsQueueMode(void)
+{
+    return queueMode;
+}
+
+/**
+ * Step position, counted when the pulse period is loaded into the timer
+ */
+int32_t StepperGetPosition(void)
+{
+    int32_t result;
+    uint32_t basepri;
+
+    if (!dmaActive)
+        return position;
+
+    basepri = CriticalEnter();
+    result = dmaActive ? StepperDmaPosition() : position;
+    CriticalExit(basepri);
+
+    return result;
+}
+
+/**
+ * Position and rate from the same instant, for tagging sensor samples
+ */
+void StepperGetTag(StepperTag *tag)
+{
+    uint32_t basepri = CriticalEnter();
+
+    if (dmaActive) {
+        tag->position = StepperDmaPosition();
+        tag->rate = StepperDmaRate();
+    } else {
+        tag->position = position;
+        tag->rate = (running && (outputInterval != 0)) ? ((int32_t)STEPPER_TICK_HZ / outputInterval) : 0;
+    }
+
+    CriticalExit(basepri);
+}
+
+void StepperSetPosition(int32_t newPosition)
+{
+    uint32_t basepri = CriticalEnter();
+
+    if (dmaActive)
+        dmaRunPosition += newPosition - StepperDmaPosition();
+    position = newPosition;
+
+    CriticalExit(basepri);
+}
+
+/**
+ * TIM4 update interrupt, called from TIM4_IRQHandler()
+ */
+void StepperTimerIrq(void)
+{
+    if ((TIM4->SR & TIM_SR_UIF) == 0)
+        return;
+    TIM4->SR = ~TIM_SR_UIF;
+
+    if (loadedPulse)
+        position += activeDir;
+    // The preloaded period is the one starting now
+    outputInterval = loadedInterval;
+
+    StepperLoadNext();
+}
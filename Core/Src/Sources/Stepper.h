@@ -0,0 +1,89 @@
+#ifndef _STEPPER_H
+#define _STEPPER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "main.h"
+
+/**
+ * Step timing. TIM4 runs from the 64 MHz APB1 timer clock with prescaler 32,
+ * one tick = 0.5 us. A step interval is one or more timer periods, the step
+ * pulse is the PWM high time at the start of the first period.
+ */
+#define STEPPER_TICK_HZ             2000000UL
+#define STEPPER_PULSE_TICKS         5           // 2.5 us STEP high time
+#define STEPPER_DIR_SETUP_TICKS     100         // Idle period around DIR changes, 50 us
+#define STEPPER_MAX_RATE            50000       // steps/s, 40 ticks per step
+#define STEPPER_MAX_INTERVAL        STEPPER_TICK_HZ // Slowest step interval, 1 step/s
+#define STEPPER_UNDERRUN_TICKS      200         // Idle period while waiting for queued segments, 100 us
+
+/**
+ * Segment queue, filled by the motion planner and emptied by the update interrupt
+ */
+#define STEPPER_QUEUE_SIZE          32          // Power of two
+#define STEPPER_SEGMENT_LAST        0x0001      // Stop when this segment is done and the queue is empty
+
+/**
+ * DMA mode buffer, refilled one half at a time (32 periods = 640 us at the maximum rate)
+ */
+#define STEPPER_DMA_PERIODS         64
+
+/**
+ * Driver pin polarity
+ */
+#define STEPPER_EN_ACTIVE           GPIO_PIN_RESET  // Driver enable input is active low
+#define STEPPER_EN_INACTIVE         GPIO_PIN_SET
+#define STEPPER_DIR_POSITIVE        GPIO_PIN_SET    // DIR level for increasing position
+#define STEPPER_DIR_NEGATIVE        GPIO_PIN_RESET
+#define STEPPER_FLT_ACTIVE          GPIO_PIN_RESET  // Driver fault output is open drain, active low
+
+/**
+ * Run of steps at a constant interval
+ */
+typedef struct {
+    int32_t  interval;          // Signed ticks per step, sign = direction
+    uint16_t steps;
+    uint16_t flags;             // STEPPER_SEGMENT_xxx
+} StepperSegment;
+
+/**
+ * Latched driver fault
+ */
+typedef struct {
+    uint32_t timeMs;            // HAL tick at the fault edge
+    int32_t  position;          // Step position when stepping was stopped
+    int32_t  rate;              // Step rate at the fault, steps/s
+} StepperFault;
+
+/**
+ * Motor state latched together with a sensor sample
+ */
+typedef struct {
+    int32_t position;           // Absolute step position
+    int32_t rate;               // Signed step rate of the step in progress, steps/s
+} StepperTag;
+
+void StepperInit(void);
+void StepperEnable(bool enable);
+bool StepperIsEnabled(void);
+bool StepperIsFaulted(void);
+bool StepperGetFaultEvent(StepperFault *fault);
+int32_t StepperRearm(void);
+void StepperFaultIrq(void);
+void StepperSetDma(bool enable);
+int32_t StepperSetRate(int32_t stepsPerSecond);
+int32_t StepperSetInterval(int32_t ticks);
+void StepperStop(void);
+bool StepperIsRunning(void);
+bool StepperIsQueueMode(void);
+int32_t StepperGetPosition(void);
+void StepperGetTag(StepperTag *tag);
+void StepperSetPosition(int32_t position);
+int32_t StepperGetRate(void);
+int8_t StepperGetDirection(void);
+bool StepperQueuePush(const StepperSegment *segment);
+uint16_t StepperQueueFree(void);
+int32_t StepperQueueStart(void);
+uint32_t StepperGetUnderruns(void);
+void StepperTimerIrq(void);
+#endif
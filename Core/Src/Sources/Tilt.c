@@ -0,0 +1,140 @@
+/* Tilt.c
+ * Pitch and roll from the averaged Acc1 or Acc3 vector, sent as a compact
+ * PKT_TILT at a fixed period instead of the sample stream.
+ *
+ * The sample handler only adds the raw axes to 64-bit sums. The closed
+ * window is handed to the housekeeping handler, which takes the means and
+ * computes both angles and the vector magnitude with two CORDIC vectorings
+ * (Cordic.c), no floating point. The per-axis scale calibration is not
+ * applied; it cancels for a nominal part and only the bias moves the angle.
+ */
+
+#include "Tilt.h"
+#include "ConfigStore.h"
+#include "Protocol.h"
+#include "Link.h"
+#include "Cordic.h"
+#include "main.h"
+
+#define TILT_MEAN_SHIFT     4           // Means in Q4 LSB
+
+#define TILT_ACC1_QUALITY_BITS  (SCH_QUALITY_ACC1_X | SCH_QUALITY_ACC1_Y | SCH_QUALITY_ACC1_Z)
+#define TILT_ACC3_QUALITY_BITS  (SCH_QUALITY_ACC3_X | SCH_QUALITY_ACC3_Y | SCH_QUALITY_ACC3_Z)
+
+typedef struct {
+    int64_t  sum[3];
+    uint32_t firstSample;
+    uint32_t samples;
+    uint32_t startMs;
+    uint8_t  source;
+} TiltWindow;
+
+static TiltWindow active;               // Sample handler
+static TiltWindow pending;              // Closed window, handed to TiltSend()
+static volatile bool pendingReady = false;
+static bool running = false;
+static bool acc3Requested = false;
+
+void TiltLoadDefaults(TiltParams *params)
+{
+    params->source   = TILT_DEFAULT_SOURCE;
+    params->reserved = 0;
+    params->periodMs = TILT_DEFAULT_PERIOD_MS;
+}
+
+static void TiltStart(uint32_t sampleCounter, uint8_t source)
+{
+    for (int axis = AXIS_X; axis <= AXIS_Z; axis++)
+        active.sum[axis] = 0;
+    active.firstSample = sampleCounter;
+    active.samples = 0;
+    active.startMs = HAL_GetTick();
+    active.source = source;
+}
+
+/**
+ * Add one sample, close the window at the period. Called from the sample
+ * handler.
+ */
+void TiltUpdate(const SCHRawData *data, uint32_t sampleCounter)
+{
+    const TiltParams *params = &appConfig.tilt;
+    bool enabled = (appConfig.streams & STREAM_TILT) != 0;
+    bool acc3 = enabled && (params->source == TILT_SOURCE_ACC3);
+    const int32_t *raw;
+
+    // Acc3 frames start with the next sample
+    if (acc3 != acc3Requested) {
+        SCHSetReadAcc3(SCH_ACC3_TILT, acc3);
+        acc3Requested = acc3;
+        running = false;
+        return;
+    }
+    if (!enabled) {
+        running = false;
+        return;
+    }
+    if (!running || (active.source != params->source)) {
+        TiltStart(sampleCounter, params->source);
+        running = true;
+    }
+
+    if (active.source == TILT_SOURCE_ACC3) {
+        raw = data->acc3Raw;
+        if (data->quality & TILT_ACC3_QUALITY_BITS)
+            raw = NULL;
+    } else {
+        raw = data->acc1Raw;
+        if (data->quality & TILT_ACC1_QUALITY_BITS)
+            raw = NULL;
+    }
+    if (raw != NULL) {
+        active.sum[AXIS_X] += raw[AXIS_X];
+        active.sum[AXIS_Y] += raw[AXIS_Y];
+        active.sum[AXIS_Z] += raw[AXIS_Z];
+        active.samples++;
+    }
+
+    if ((HAL_GetTick() - active.startMs) < params->periodMs)
+        return;
+
+    if (!pendingReady && (active.samples > 0)) {
+        pending = active;
+        __DMB();
+        pendingReady = true;
+    }
+    TiltStart(sampleCounter + 1, params->source);
+}
+
+/**
+ * Compute and send the angles of a closed window. Called from the
+ * housekeeping handler.
+ */
+void TiltSend(void)
+{
+    PktTilt pkt;
+    int32_t mean[3];
+    uint32_t sensitivity, horizontal, norm, magnitude;
+
+    if (!pendingReady)
+        return;
+
+    for (int axis = AXIS_X; axis <= AXIS_Z; axis++)
+    {
+        mean[axis] = (int32_t)((pending.sum[axis] << TILT_MEAN_SHIFT) / (int64_t)pending.samples);
+        if (pending.source == TILT_SOURCE_ACC1)
+            mean[axis] -= appConfig.calibration.acc1Bias[axis] << TILT_MEAN_SHIFT;
+    }
+
+    pkt.roll  = (int16_t)CordicToCentiDegrees(CordicVector(mean[AXIS_Z], mean[AXIS_Y], &horizontal));
+    pkt.pitch = (int16_t)CordicToCentiDegrees(CordicVector((int32_t)horizontal, -mean[AXIS_X], &norm));
+
+    sensitivity = (pending.source == TILT_SOURCE_ACC3) ? appConfig.sensitivity.acc3 : appConfig.sensitivity.acc1;
+    magnitude = (uint32_t)(((uint64_t)norm * 1000U) / ((uint64_t)sensitivity << TILT_MEAN_SHIFT));
+    pkt.magnitude = (uint16_t)((magnitude > UINT16_MAX) ? UINT16_MAX : magnitude);
+    pkt.firstSample = pending.firstSample;
+    pkt.samples = (uint16_t)((pending.samples > UINT16_MAX) ? UINT16_MAX : pending.samples);
+
+    pendingReady = false;
+    LinkSend(PKT_TILT, &pkt, sizeof(pkt));
+}
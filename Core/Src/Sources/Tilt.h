@@ -0,0 +1,47 @@
+#ifndef _TILT_H
+#define _TILT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "SCHSensor.h"
+
+/**
+ * Accelerometer used for the inclination (PARAM_TILT_SOURCE)
+ */
+#define TILT_SOURCE_ACC1            0
+#define TILT_SOURCE_ACC3            1   // Adds the Acc3 frames to every sample while STREAM_TILT is on
+
+#define TILT_MIN_PERIOD_MS          10
+#define TILT_MAX_PERIOD_MS          60000
+
+/**
+ * Default output: Acc1 averaged over 100 ms, 10 packets/s
+ */
+#define TILT_DEFAULT_SOURCE         TILT_SOURCE_ACC1
+#define TILT_DEFAULT_PERIOD_MS      100
+
+/**
+ * Inclination parameters, part of the persistent configuration
+ */
+typedef struct {
+    uint8_t  source;            // TILT_SOURCE_xxx
+    uint8_t  reserved;
+    uint16_t periodMs;          // Averaging window and packet period, TILT_MIN/MAX_PERIOD_MS
+} TiltParams;
+
+/**
+ * PKT_TILT payload, one per period (STREAM_TILT). Angles of the averaged
+ * acceleration vector, Acc1 bias calibrated; +Z up reads 0, 0.
+ */
+typedef struct {
+    uint32_t firstSample;       // Sample counter of the first sample in the average
+    int16_t  pitch;             // 0.01 deg, atan2(-x, sqrt(y^2 + z^2)), -9000..9000
+    int16_t  roll;              // 0.01 deg, atan2(y, z), -18000..18000
+    uint16_t magnitude;         // mm/s2 at the nominal sensitivity, 1 g reads about 9807
+    uint16_t samples;           // Samples averaged, saturated at 65535
+} PktTilt;
+
+void TiltLoadDefaults(TiltParams *params);
+void TiltUpdate(const SCHRawData *data, uint32_t sampleCounter);
+void TiltSend(void);
+#endif
@@ -0,0 +1,246 @@
+/* Trace.c
+ * Binary event trace ring, streamed over the link as a side channel.
+ *
+ * Records are written from interrupts and thread mode without locking: a
+ * slot is reserved by incrementing the write index with LDREX/STREX, and
+ * the record is committed by writing its sequence byte (low bits of the
+ * index) last. The reader (TraceDrain(), housekeeping) stops at a slot whose
+ * sequence does not match yet, and drops what was overwritten while it
+ * copied.
+ *
+ * The ring always records, overwriting the oldest records. It is frozen by
+ * a sensor recovery, a driver fault or a dump request; a frozen ring is
+ * sent once and kept until the host restarts the trace. Streaming only uses
+ * link TX space above TRACE_DRAIN_MIN_FREE, records that cannot be sent in
+ * time are counted as lost. A hard fault sends the whole ring from the
+ * fault handler with polled UART writes (TraceFaultDump()), as the
+ * housekeeping event never runs again.
+ */
+
+#include "Trace.h"
+#include "Link.h"
+#include "Critical.h"
+#include "main.h"
+
+static TraceRecord ring[TRACE_RECORDS];
+static volatile uint32_t head = 0;          // Next record index, reserved by writers
+static volatile uint32_t eventMask = 0;     // Recorded events, 1 << TraceEvent
+static volatile bool frozen = false;
+static volatile bool dumpRequest = false;   // Set on freeze, picked up by TraceDrain()
+
+// Reader state, housekeeping event and CriticalEnter() sections only
+static uint32_t tail = 0;                   // Next record index to send
+static uint32_t lost = 0;
+static bool streaming = false;
+static bool dumping = false;
+
+void TraceInit(void)
+{
+    // Every slot starts as not committed for its first index
+    for (uint32_t i = 0; i < TRACE_RECORDS; i++)
+        ring[i].sequence = (uint8_t)(i - TRACE_RECORDS);
+
+    head = 0;
+    tail = 0;
+    lost = 0;
+    frozen = false;
+    dumpRequest = false;
+    streaming = false;
+    dumping = false;
+    eventMask = TRACE_MASK_ALL;
+}
+
+/**
+ * Add one record, callable from any context
+ */
+void TraceWrite(TraceEvent event, uint16_t arg)
+{
+    TraceRecord *record;
+    uint32_t index;
+
+    if (frozen || ((eventMask & (1UL << event)) == 0))
+        return;
+
+    // Reserve a slot, retried when an interrupt reserved one in between
+    do {
+        index = __LDREXW(&head);
+    } while (__STREXW(index + 1, &head) != 0);
+
+    record = &ring[index & (TRACE_RECORDS - 1)];
+    record->cycles = DWT->CYCCNT;
+    record->event = (uint8_t)event;
+    record->arg = arg;
+    __DMB();
+    record->sequence = (uint8_t)index;
+}
+
+/**
+ * Stop recording and send the ring. Callable from any context.
+ */
+void TraceFreeze(void)
+{
+    if (frozen)
+        return;
+
+    frozen = true;
+    dumpRequest = true;
+}
+
+/**
+ * Freeze the ring and send all of it by polling the link UART. Called from
+ * the hard fault handler; records reserved but never written are skipped.
+ */
+void TraceFaultDump(void)
+{
+    PktTrace pkt;
+    uint32_t last;
+    uint32_t index;
+    uint32_t count;
+
+    frozen = true;
+    last = head;
+    index = (last > TRACE_RECORDS) ? (last - TRACE_RECORDS) : 0;
+
+    while (index != last) {
+        count = 0;
+        while ((index + count != last) && (count < TRACE_RECORDS_PER_PACKET)) {
+            pkt.records[count] = ring[(index + count) & (TRACE_RECORDS - 1)];
+            if (pkt.records[count].sequence != (uint8_t)(index + count))
+                break;
+            count++;
+        }
+
+        if (count > 0) {
+            pkt.header.index = index;
+            pkt.header.timeMs = HAL_GetTick();
+            pkt.header.lost = 0;
+            pkt.header.count = (uint8_t)count;
+            pkt.header.frozen = true;
+            LinkSendPolled(PKT_TRACE, &pkt, (uint8_t)(sizeof(pkt.header) + count * sizeof(TraceRecord)));
+            index += count;
+        }
+        else {
+            index++;
+        }
+    }
+}
+
+/**
+ * @brief Change the trace mode.
+ *
+ * @param mode - TRACE_MODE_xxx
+ * @param mask - recorded events, 1 << TraceEvent, 0 = unchanged
+ * @return SCH_OK or SCH_ERR_INVALID_PARAM
+ */
+int32_t TraceSetMode(uint8_t mode, uint32_t mask)
+{
+    uint32_t basepri;
+
+    if ((mode > TRACE_MODE_RESTART) || ((mask & ~TRACE_MASK_ALL) != 0))
+        return SCH_ERR_INVALID_PARAM;
+
+    basepri = CriticalEnter();
+    if (mask != 0)
+        eventMask = mask;
+
+    switch (mode)
+    {
+        case TRACE_MODE_STOP:
+            streaming = false;
+            break;
+
+        case TRACE_MODE_STREAM:
+            // Start from the current write position
+            if (!streaming && !dumping) {
+                tail = head;
+                lost = 0;
+            }
+            streaming = true;
+            break;
+
+        case TRACE_MODE_DUMP:
+            frozen = true;
+            dumpRequest = true;
+            break;
+
+        case TRACE_MODE_RESTART:
+            tail = head;
+            lost = 0;
+            dumping = false;
+            dumpRequest = false;
+            frozen = false;
+            break;
+
+        default:
+            break;
+    }
+    CriticalExit(basepri);
+
+    return SCH_OK;
+}
+
+/**
+ * Send pending records, at most one packet per call. Called from the
+ * housekeeping handler.
+ */
+void TraceDrain(void)
+{
+    PktTrace pkt;
+    uint32_t last;
+    uint32_t count = 0;
+
+    if (dumpRequest) {
+        dumpRequest = false;
+        // Not streaming: the dump is the whole ring
+        if (!streaming || ((head - tail) > TRACE_RECORDS)) {
+            tail = (head > TRACE_RECORDS) ? (head - TRACE_RECORDS) : 0;
+            lost = 0;
+        }
+        dumping = true;
+    }
+
+    if (!streaming && !dumping)
+        return;
+    if (LinkTxFree() < (TRACE_DRAIN_MIN_FREE + sizeof(pkt) + LINK_HEADER_SIZE + LINK_CRC_SIZE))
+        return;
+
+    last = head;
+    if ((last - tail) > TRACE_RECORDS) {
+        lost += (last - tail) - TRACE_RECORDS;
+        tail = last - TRACE_RECORDS;
+    }
+
+    while ((tail + count != last) && (count < TRACE_RECORDS_PER_PACKET)) {
+        uint32_t index = tail + count;
+
+        pkt.records[count] = ring[index & (TRACE_RECORDS - 1)];
+        // Reserved but not yet written
+        if (pkt.records[count].sequence != (uint8_t)index)
+            break;
+        count++;
+    }
+
+    // Overwritten while copying: drop the packet, retried on the next call
+    if ((head - tail) > TRACE_RECORDS) {
+        lost += count;
+        tail += count;
+        return;
+    }
+
+    if (count == 0) {
+        if (dumping && frozen && (tail == last))
+            dumping = false;
+        return;
+    }
+
+    pkt.header.index = tail;
+    pkt.header.timeMs = HAL_GetTick();
+    pkt.header.lost = (lost > UINT16_MAX) ? UINT16_MAX : (uint16_t)lost;
+    pkt.header.count = (uint8_t)count;
+    pkt.header.frozen = frozen;
+
+    if (LinkSend(PKT_TRACE, &pkt, (uint8_t)(sizeof(pkt.header) + count * sizeof(TraceRecord)))) {
+        tail += count;
+        lost = 0;
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TRACE_RECORDS               128     // Ring size, power of two
+#define TRACE_RECORDS_PER_PACKET    28      // Records in one PKT_TRACE
+#define TRACE_DRAIN_MIN_FREE        512     // Link TX bytes left free for the sample stream
+
+/**
+ * Trace events, argument in brackets
+ */
+typedef enum {
+    TRACE_TICK = 0,             // TIM2 interrupt entry (us since the update event)
+    TRACE_SPI_START,            // Sample read start
+    TRACE_SPI_END,              // Sample read end (SCH_QUALITY_xxx bits)
+    TRACE_STATUS_READ,          // Interleaved status register read (register index)
+    TRACE_STATUS_FAULT,         // Status register not OK (register index)
+    TRACE_RECOVERY,             // Sensor restart after a confirmed fault (recovery count)
+    TRACE_TX_START,             // Link DMA transmission started (bytes)
+    TRACE_TX_DONE,              // Link DMA transmission complete (bytes)
+    TRACE_TX_DROP,              // Link frame dropped, TX buffer full (packet type)
+    TRACE_RX_EVENT,             // Link RX idle or DMA half/full
+    TRACE_COMMAND,              // Host command executed (command)
+    TRACE_STEP_DMA,             // Step DMA half refilled (half)
+    TRACE_LIMIT,                // LIMIT switch stop (position, low 16 bits)
+    TRACE_MOTOR_FAULT,          // MOTOR_FLT latched (position, low 16 bits)
+    TRACE_EVENTS
+} TraceEvent;
+
+#define TRACE_MASK_ALL              ((1UL << TRACE_EVENTS) - 1)
+
+/**
+ * CMD_TRACE modes
+ */
+#define TRACE_MODE_STOP             0   // Stop streaming, keep recording
+#define TRACE_MODE_STREAM           1   // Stream records as they are written
+#define TRACE_MODE_DUMP             2   // Freeze and send the ring once
+#define TRACE_MODE_RESTART          3   // Discard the ring and resume recording
+
+typedef struct {
+    uint32_t cycles;            // DWT->CYCCNT at the event
+    uint8_t  event;             // TraceEvent
+    uint8_t  sequence;          // Low bits of the record index, written last
+    uint16_t arg;
+} TraceRecord;
+
+typedef struct {
+    uint32_t index;             // Ring index of the first record
+    uint32_t timeMs;            // HAL tick when the packet was sent, anchors the cycle count
+    uint16_t lost;              // Records overwritten before they were sent, since the last packet
+    uint8_t  count;             // Records in this packet
+    uint8_t  frozen;            // Ring frozen by a fault or a dump request
+} TraceHeader;
+
+/**
+ * PKT_TRACE payload, sized to the records it carries
+ */
+typedef struct {
+    TraceHeader header;
+    TraceRecord records[TRACE_RECORDS_PER_PACKET];
+} PktTrace;
+
+void TraceInit(void);
+void TraceWrite(TraceEvent event, uint16_t arg);
+void TraceFreeze(void);
+void TraceFaultDump(void);
+int32_t TraceSetMode(uint8_t mode, uint32_t mask);
+void TraceDrain(void);
+#endif
@@ -0,0 +1,239 @@
+/* ZeroMotion.c
+ * Stationarity detection and Rate1 bias tracking.
+ *
+ * Samples are grouped into windows of windowSamples. Per sample the Rate1
+ * norm (bias corrected) and the Acc1 norm are approximated with shifts and
+ * adds, and their offsets from the first value of the window are added to
+ * 64-bit sums and sums of squares, together with the raw Rate1 per axis.
+ * At the end of a window the two norm variances are compared with the
+ * configured noise limits; stillWindows consecutive quiet windows mean the
+ * unit is still.
+ *
+ * In ZERO_MOTION_TRACK mode every still window moves the bias towards the
+ * window's mean raw rate by 2^-biasShift, and the result replaces the
+ * calibration bias in the output path (SCHSetRate1BiasTrack()). Anything
+ * constant while still is taken as bias, including the earth rate. A
+ * steady rotation also has quiet norms, so windows in which the stepper
+ * ran or a rate table calibration was in progress never count as quiet:
+ * the table rate must not be learned as bias.
+ */
+
+#include "ZeroMotion.h"
+#include "ConfigStore.h"
+#include "Protocol.h"
+#include "Link.h"
+#include "Stepper.h"
+#include "Calibration.h"
+#include "main.h"
+
+#define ZERO_MOTION_QUALITY_BITS    (SCH_QUALITY_RATE1_X | SCH_QUALITY_RATE1_Y | SCH_QUALITY_RATE1_Z | \
+                                     SCH_QUALITY_ACC1_X | SCH_QUALITY_ACC1_Y | SCH_QUALITY_ACC1_Z)
+
+static uint8_t activeMode = ZERO_MOTION_OFF;
+static int32_t bias[3];                 // Q8 LSB
+static uint32_t updates = 0;
+static bool still = false;
+static uint16_t quietWindows = 0;
+
+// Window accumulators
+static uint16_t samples = 0;
+static int32_t rateRef, accRef;         // Norms of the first sample in the window
+static int64_t rateSum, accSum;
+static uint64_t rateSumSquares, accSumSquares;
+static int64_t rateAxisSum[3];          // Raw Rate1
+static bool turned;                     // Stepper ran or calibration busy during the window
+static uint32_t rateVariance = 0;
+static uint32_t accVariance = 0;
+
+// Report handed to the housekeeping handler
+static PktZeroMotion report;
+static volatile bool reportReady = false;
+static uint32_t lastReportMs = 0;
+
+void ZeroMotionLoadDefaults(ZeroMotionParams *params)
+{
+    params->mode          = ZERO_MOTION_OFF;
+    params->stillWindows  = ZERO_MOTION_DEFAULT_STILL_WINDOWS;
+    params->biasShift     = ZERO_MOTION_DEFAULT_BIAS_SHIFT;
+    params->reserved      = 0;
+    params->windowSamples = ZERO_MOTION_DEFAULT_WINDOW;
+    params->reserved2     = 0;
+    params->rateNoise     = ZERO_MOTION_DEFAULT_RATE_NOISE;
+    params->accNoise      = ZERO_MOTION_DEFAULT_ACC_NOISE;
+}
+
+/**
+ * Start tracking from the calibration bias
+ */
+static void ZeroMotionSeed(void)
+{
+    for (int axis = AXIS_X; axis <= AXIS_Z; axis++)
+        bias[axis] = appConfig.calibration.rate1Bias[axis] * 256;
+    updates = 0;
+    SCHSetRate1BiasTrack(bias);
+}
+
+/**
+ * Apply a mode change. Tracking starts from the calibration bias, leaving
+ * it returns the output to the calibration bias.
+ */
+void ZeroMotionConfigure(void)
+{
+    uint8_t mode = appConfig.zeroMotion.mode;
+
+    if (mode == activeMode)
+        return;
+
+    if (mode == ZERO_MOTION_TRACK) {
+        ZeroMotionSeed();
+    } else if (activeMode == ZERO_MOTION_TRACK) {
+        SCHSetRate1BiasTrack(NULL);
+    }
+
+    samples = 0;
+    quietWindows = 0;
+    still = false;
+    activeMode = mode;
+}
+
+/**
+ * Restart tracking from a newly applied calibration bias. Outside
+ * ZERO_MOTION_TRACK the output already uses the calibration bias.
+ */
+void ZeroMotionReseed(void)
+{
+    if (activeMode == ZERO_MOTION_TRACK)
+        ZeroMotionSeed();
+}
+
+/**
+ * Vector norm approximation, max + 3/8 mid + 1/4 min (within 7 %)
+ */
+static int32_t ZeroMotionNorm(int32_t x, int32_t y, int32_t z)
+{
+    int32_t a = (x < 0) ? -x : x;
+    int32_t b = (y < 0) ? -y : y;
+    int32_t c = (z < 0) ? -z : z;
+    int32_t t;
+
+    if (a < b) { t = a; a = b; b = t; }
+    if (a < c) { t = a; a = c; c = t; }
+    if (b < c) { t = b; b = c; c = t; }
+
+    return a + ((3 * b) >> 3) + (c >> 2);
+}
+
+static uint32_t ZeroMotionVariance(int64_t sum, uint64_t sumSquares, uint32_t n)
+{
+    int64_t mean = sum / (int64_t)n;
+    int64_t variance = (int64_t)(sumSquares / n) - mean * mean;
+
+    if (variance < 0)
+        return 0;
+    return (variance > UINT32_MAX) ? UINT32_MAX : (uint32_t)variance;
+}
+
+static void ZeroMotionEndWindow(uint32_t n)
+{
+    const ZeroMotionParams *params = &appConfig.zeroMotion;
+    int64_t rateLimit = ((int64_t)params->rateNoise * appConfig.sensitivity.rate1) / 1000;
+    int64_t accLimit  = ((int64_t)params->accNoise * appConfig.sensitivity.acc1) / 1000;
+    bool wasStill = still;
+    uint32_t now;
+
+    rateVariance = ZeroMotionVariance(rateSum, rateSumSquares, n);
+    accVariance  = ZeroMotionVariance(accSum, accSumSquares, n);
+
+    if (!turned && (rateVariance <= rateLimit * rateLimit) && (accVariance <= accLimit * accLimit)) {
+        if (quietWindows < UINT16_MAX)
+            quietWindows++;
+    } else {
+        quietWindows = 0;
+    }
+    still = (quietWindows >= params->stillWindows);
+
+    if (still && (activeMode == ZERO_MOTION_TRACK)) {
+        for (int axis = AXIS_X; axis <= AXIS_Z; axis++)
+        {
+            int32_t mean = (int32_t)((rateAxisSum[axis] * 256) / (int64_t)n);
+            bias[axis] += (mean - bias[axis]) >> params->biasShift;
+        }
+        updates++;
+        SCHSetRate1BiasTrack(bias);
+    }
+
+    now = HAL_GetTick();
+    if (((still == wasStill) && ((now - lastReportMs) < ZERO_MOTION_REPORT_MS)) || reportReady)
+        return;
+    lastReportMs = now;
+
+    for (int axis = AXIS_X; axis <= AXIS_Z; axis++)
+        report.bias[axis] = (activeMode == ZERO_MOTION_TRACK) ? bias[axis] : (appConfig.calibration.rate1Bias[axis] * 256);
+    report.rateVariance = rateVariance;
+    report.accVariance = accVariance;
+    report.updates = updates;
+    report.quietWindows = quietWindows;
+    report.still = still;
+    report.mode = activeMode;
+    __DMB();
+    reportReady = true;
+}
+
+/**
+ * Add one sample. Called from the sample handler.
+ */
+void ZeroMotionUpdate(const SCHRawData *data)
+{
+    int32_t rateNorm, accNorm, offset;
+
+    if (activeMode == ZERO_MOTION_OFF)
+        return;
+    if (data->quality & ZERO_MOTION_QUALITY_BITS)
+        return;
+
+    rateNorm = ZeroMotionNorm(SCHGetRate1Counts(data, AXIS_X), SCHGetRate1Counts(data, AXIS_Y),
+                              SCHGetRate1Counts(data, AXIS_Z));
+    accNorm  = ZeroMotionNorm(data->acc1Raw[AXIS_X], data->acc1Raw[AXIS_Y], data->acc1Raw[AXIS_Z]);
+
+    if (samples == 0) {
+        rateRef = rateNorm;
+        accRef = accNorm;
+        rateSum = 0;
+        accSum = 0;
+        rateSumSquares = 0;
+        accSumSquares = 0;
+        for (int axis = AXIS_X; axis <= AXIS_Z; axis++)
+            rateAxisSum[axis] = 0;
+        turned = false;
+    }
+    if (StepperIsRunning() || CalibrationIsBusy())
+        turned = true;
+
+    offset = rateNorm - rateRef;
+    rateSum += offset;
+    rateSumSquares += (uint64_t)((int64_t)offset * offset);
+    offset = accNorm - accRef;
+    accSum += offset;
+    accSumSquares += (uint64_t)((int64_t)offset * offset);
+    rateAxisSum[AXIS_X] += data->rate1Raw[AXIS_X];
+    rateAxisSum[AXIS_Y] += data->rate1Raw[AXIS_Y];
+    rateAxisSum[AXIS_Z] += data->rate1Raw[AXIS_Z];
+
+    if (++samples < appConfig.zeroMotion.windowSamples)
+        return;
+
+    ZeroMotionEndWindow(samples);
+    samples = 0;
+}
+
+/**
+ * Send the pending report. Called from the housekeeping handler.
+ */
+void ZeroMotionSend(void)
+{
+    if (!reportReady)
+        return;
+
+    LinkSend(PKT_ZERO_MOTION, &report, sizeof(report));
+    reportReady = false;
+}
@@ -0,0 +1,61 @@
+#ifndef _ZEROMOTION_H
+#define _ZEROMOTION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "SCHSensor.h"
+
+#define ZERO_MOTION_REPORT_MS       1000    // PKT_ZERO_MOTION period, and on every still/moving change
+
+/**
+ * Modes (PARAM_ZMOTION_MODE)
+ */
+#define ZERO_MOTION_OFF             0
+#define ZERO_MOTION_DETECT          1   // Detect and report only
+#define ZERO_MOTION_TRACK           2   // Also track the Rate1 bias and apply it to the output
+
+/**
+ * Default detector: 250 sample windows, still after 4 quiet windows,
+ * bias weight 1/16 per still window
+ */
+#define ZERO_MOTION_DEFAULT_WINDOW          250
+#define ZERO_MOTION_DEFAULT_STILL_WINDOWS   4
+#define ZERO_MOTION_DEFAULT_BIAS_SHIFT      4
+#define ZERO_MOTION_DEFAULT_RATE_NOISE      100     // mdps
+#define ZERO_MOTION_DEFAULT_ACC_NOISE       50      // mm/s2
+
+/**
+ * Detector parameters, part of the persistent configuration. A window is
+ * quiet when the standard deviations of the Rate1 and Acc1 norms are both
+ * below their limits.
+ */
+typedef struct {
+    uint8_t  mode;              // ZERO_MOTION_xxx
+    uint8_t  stillWindows;      // Consecutive quiet windows before still, 1..255
+    uint8_t  biasShift;         // Bias update weight 2^-biasShift per still window, 0..15
+    uint8_t  reserved;
+    uint16_t windowSamples;     // Samples per window, 16..4096
+    uint16_t reserved2;
+    int32_t  rateNoise;         // Rate1 norm limit, mdps
+    int32_t  accNoise;          // Acc1 norm limit, mm/s2
+} ZeroMotionParams;
+
+/**
+ * PKT_ZERO_MOTION payload
+ */
+typedef struct {
+    int32_t  bias[3];           // Tracked Rate1 bias, Q8 LSB (calibration bias until the first update)
+    uint32_t rateVariance;      // Rate1 norm variance of the last window, LSB^2
+    uint32_t accVariance;       // Acc1 norm variance of the last window, LSB^2
+    uint32_t updates;           // Bias updates since tracking started
+    uint16_t quietWindows;      // Consecutive quiet windows
+    uint8_t  still;
+    uint8_t  mode;              // ZERO_MOTION_xxx
+} PktZeroMotion;
+
+void ZeroMotionLoadDefaults(ZeroMotionParams *params);
+void ZeroMotionConfigure(void);
+void ZeroMotionReseed(void);
+void ZeroMotionUpdate(const SCHRawData *data);
+void ZeroMotionSend(void);
+#endif
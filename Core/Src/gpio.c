@@ -49,15 +49,17 @@ void MX_GPIO_Init(void)
   __HAL_RCC_GPIOB_CLK_ENABLE();
 
   /*Configure GPIO pin Output Level */
-  HAL_GPIO_WritePin(GPIOB, CS_PIN_Pin|EXTRESN_Pin|LED1_Pin|LED2_Pin
-                          |LED3_Pin|LED4_Pin|MOTOR_EN_Pin|MOTOR_DIR_Pin
-                          |MOTOR_STEP_Pin|MOTOR_FLT_Pin, GPIO_PIN_RESET);
+  HAL_GPIO_WritePin(GPIOB, LED1_Pin|LED2_Pin|LED3_Pin|LED4_Pin
+                          |MOTOR_DIR_Pin, GPIO_PIN_RESET);
 
-  /*Configure GPIO pin : LIMIT_Pin */
-  GPIO_InitStruct.Pin = LIMIT_Pin;
-  GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
-  GPIO_InitStruct.Pull = GPIO_NOPULL;
-  HAL_GPIO_Init(LIMIT_GPIO_Port, &GPIO_InitStruct);
+  /*Configure GPIO pin Output Level */
+  HAL_GPIO_WritePin(GPIOB, CS_PIN_Pin|EXTRESN_Pin|MOTOR_EN_Pin, GPIO_PIN_SET);
+
+  /*Configure GPIO pins : CAPTURE_TRIG_Pin LIMIT_Pin */
+  GPIO_InitStruct.Pin = CAPTURE_TRIG_Pin|LIMIT_Pin;
+  GPIO_InitStruct.Mode = GPIO_MODE_IT_FALLING;
+  GPIO_InitStruct.Pull = GPIO_PULLUP;
+  HAL_GPIO_Init(GPIOA, &GPIO_InitStruct);
 
   /*Configure GPIO pins : CS_PIN_Pin EXTRESN_Pin */
   GPIO_InitStruct.Pin = CS_PIN_Pin|EXTRESN_Pin;
@@ -73,14 +75,30 @@ void MX_GPIO_Init(void)
   HAL_GPIO_Init(SCH_DRY_GPIO_Port, &GPIO_InitStruct);
 
   /*Configure GPIO pins : LED1_Pin LED2_Pin LED3_Pin LED4_Pin
-                           MOTOR_EN_Pin MOTOR_DIR_Pin MOTOR_STEP_Pin MOTOR_FLT_Pin */
+                           MOTOR_EN_Pin MOTOR_DIR_Pin */
   GPIO_InitStruct.Pin = LED1_Pin|LED2_Pin|LED3_Pin|LED4_Pin
-                          |MOTOR_EN_Pin|MOTOR_DIR_Pin|MOTOR_STEP_Pin|MOTOR_FLT_Pin;
+                          |MOTOR_EN_Pin|MOTOR_DIR_Pin;
   GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
   GPIO_InitStruct.Pull = GPIO_NOPULL;
   GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_HIGH;
   HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
 
+  /*Configure GPIO pin : MOTOR_FLT_Pin */
+  GPIO_InitStruct.Pin = MOTOR_FLT_Pin;
+  GPIO_InitStruct.Mode = GPIO_MODE_IT_FALLING;
+  GPIO_InitStruct.Pull = GPIO_PULLUP;
+  HAL_GPIO_Init(MOTOR_FLT_GPIO_Port, &GPIO_InitStruct);
+
+  /* EXTI interrupt init*/
+  HAL_NVIC_SetPriority(EXTI0_IRQn, 1, 0);
+  HAL_NVIC_EnableIRQ(EXTI0_IRQn);
+
+  HAL_NVIC_SetPriority(EXTI4_IRQn, 1, 0);
+  HAL_NVIC_EnableIRQ(EXTI4_IRQn);
+
+  HAL_NVIC_SetPriority(EXTI9_5_IRQn, 1, 0);
+  HAL_NVIC_EnableIRQ(EXTI9_5_IRQn);
+
 }
 
 /* USER CODE BEGIN 2 */
@@ -29,6 +29,23 @@
 #include <stdbool.h>
 #include <string.h>
 #include "./Sources/SCHsensor.h"
+#include "./Sources/ConfigStore.h"
+#include "./Sources/Link.h"
+#include "./Sources/Stepper.h"
+#include "./Sources/Motion.h"
+#include "./Sources/Controller.h"
+#include "./Sources/Homing.h"
+#include "./Sources/Calibration.h"
+#include "./Sources/Scheduler.h"
+#include "./Sources/Profiler.h"
+#include "./Sources/Trace.h"
+#include "./Sources/SampleRate.h"
+#include "./Sources/Capture.h"
+#include "./Sources/Stats.h"
+#include "./Sources/Fft.h"
+#include "./Sources/ZeroMotion.h"
+#include "./Sources/Tilt.h"
+#include "./Sources/Allan.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -36,22 +53,46 @@
 
 SCHResult DataSCH16;
 
-static volatile bool SCH1_error_available = false;
 SCHRawData SCH1_summed_data_buffer;
 
 // Function prototypes
 static void SystemClock_Config(void);
 static void readingSCHData_callback(void);
+static void sendingSCHData(void);
+static void startingSCH_callback(void);
+static void sendingStatus(void);
+static void sendingHealth(void);
+static void sendingMotorFault(void);
+static void sendingMotionStatus(void);
+static void sampleEvent(void);
+static void motorEvent(void);
+static void housekeepingEvent(void);
 
 char serialNum[15];
 
-typedef struct{
-	uint8_t timerCallback : 1;
-	uint8_t uartCallback : 1;
-}flag_t;
-
-flag_t systemFlag = {0};
 SCHResult Data;
+static volatile uint32_t sampleTicks = 0;    // TIM2 updates since boot
+static uint32_t sampleCounter = 0;           // sampleTicks at the last sample read
+static bool sampleCounterValid = false;      // sampleCounter belongs to the running sensor start
+static uint32_t missedSamples = 0;           // Ticks passed without a sample read
+static uint16_t outputCounter = 0;
+static StepperTag sampleTag;           // Motor state at the last acquisition
+
+#define STATUS_PERIOD_STARTING_MS   100     // "sensor starting" status frames
+#define STATUS_PERIOD_RUNNING_MS    1000
+#define HEALTH_PERIOD_MS            1000
+#define MOTION_STATUS_PERIOD_MS     100
+#define INIT_RETRY_DELAY_MS         50
+
+static uint32_t firstValidSampleMs = 0;
+static uint32_t lastStatusMs = 0;
+static uint32_t lastHealthMs = 0;
+static uint32_t lastMotionStatusMs = 0;
+static bool motionWasBusy = false;
+static uint32_t initRetryMs = 0;
+static uint16_t initFailures = 0;
+static uint8_t startMode = START_MODE_COLD;
+static uint16_t recoveries = 0;
 /* USER CODE END PTD */
 
 /* Private define ------------------------------------------------------------*/
@@ -89,10 +130,7 @@ int main(void)
 {
 
   /* USER CODE BEGIN 1 */
-	SCHFilter         Filter;
-	SCHSensitivity    Sensitivity;
-	SCHDecimation     Decimation;
-	int  init_status;
+
   /* USER CODE END 1 */
 
   /* MCU Configuration--------------------------------------------------------*/
@@ -119,32 +157,41 @@ int main(void)
   MX_USART1_UART_Init();
   MX_TIM2_Init();
   /* USER CODE BEGIN 2 */
-	Filter.rate = FILTER_RATE;
-	Filter.acc  = FILTER_ACC12;
-	Filter.acc3 = FILTER_ACC3;
-
-	// SCH1600 sensitivity settings
-	Sensitivity.rate1 = SENSITIVITY_RATE1;
-	Sensitivity.rate2 = SENSITIVITY_RATE2;
-	Sensitivity.acc1  = SENSITIVITY_ACC1;
-	Sensitivity.acc2  = SENSITIVITY_ACC2;
-	Sensitivity.acc3  = SENSITIVITY_ACC3;
-
-	// SCH1600 decimation settings (for Rate2 and Acc2 channels).
-	Decimation.rate2 = DECIMATION_RATE;
-	Decimation.acc2  = DECIMATION_ACC;
-	// Initialize the sensor
-	init_status = SCHInit(Filter, Sensitivity, Decimation, false);
-	if (init_status != SCH_OK) {
-		 HAL_Delay(50);
-		 SCHReset();
-		 NVIC_SystemReset();
+	TraceInit();
+
+	// Filters, sensitivities, decimation, link settings and calibration come from
+	// the configuration store (factory defaults when the store is empty).
+	ConfigLoad();
+	LinkInit(appConfig.baudRate);
+	SCHSetCalibration(&appConfig.calibration);
+	ZeroMotionConfigure();
+	StepperInit();
+
+	// After an MCU-only reset (software, watchdog, reset pin) the sensor may still be
+	// streaming with the right configuration, resume it without the full startup.
+	// Otherwise start initialization in the background: the sample timer drives the
+	// startup state machine, the link and commands are available immediately.
+	if (!__HAL_RCC_GET_FLAG(RCC_FLAG_PORRST) &&
+	    SCHWarmStart(appConfig.filter, appConfig.sensitivity, appConfig.decimation, appConfig.enableDry))
+	{
+		startMode = START_MODE_WARM;
+		strcpy(serialNum, SCHGetSnbr());
+	}
+	else
+	{
+		SCHInitStart(appConfig.filter, appConfig.sensitivity, appConfig.decimation, appConfig.enableDry);
 	}
-	/** read serial number sensor**/
-	strcpy(serialNum, SCHGetSnbr());
-	// With 1000 Hz sample rate and 10x averaging we get Output Data Rate (ODR) of 100 Hz.
+	__HAL_RCC_CLEAR_RESET_FLAGS();
+
+	// Everything after this point runs from scheduler events
+	SchedulerInit();
+	SchedulerRegister(SCHEDULER_EVENT_SAMPLE, sampleEvent);
+	SchedulerRegister(SCHEDULER_EVENT_MOTOR, motorEvent);
+	SchedulerRegister(SCHEDULER_EVENT_COMMAND, LinkPoll);
+	SchedulerRegister(SCHEDULER_EVENT_HOUSEKEEPING, housekeepingEvent);
+	SchedulerRegister(SCHEDULER_EVENT_BACKGROUND, FftBackground);
+	SampleRateInit();
 	HAL_TIM_Base_Start_IT(&htim2);
-	HAL_UART_Transmit_DMA(&huart1, (uint8_t*)&Data, sizeof(Data));
 
 
   /* USER CODE END 2 */
@@ -153,25 +200,8 @@ int main(void)
   /* USER CODE BEGIN WHILE */
   while (1)
   {
-  	/***If  SCH sensor has a problem, it will be restarted. ***/
-		if (SCH1_error_available) {
-				// Error from sensor. Stop sample timer to avoid race condition when reading status.
-				HAL_TIM_Base_Stop_IT(&htim2);
-				SCH1_error_available = false;
-				// Read SCH1600 status registers
-				SCHStatus Status;
-				SCHGetStatus(&Status);
-				// Restart sampling timer
-				HAL_TIM_Base_Start_IT(&htim2);
-		}
-		/*** reading SCH sensor data every 1ms  ***/
-		if(systemFlag.timerCallback && systemFlag.uartCallback)
-		{
-			systemFlag.timerCallback = 0;
-			systemFlag.uartCallback = 0;
-			readingSCHData_callback();
-			HAL_UART_Transmit_DMA(&huart1, (uint8_t*)&Data, sizeof(Data));
-		}
+		/*** run pending events by priority, sleep when idle ***/
+		SchedulerDispatch();
     /* USER CODE END WHILE */
 
     /* USER CODE BEGIN 3 */
@@ -260,33 +290,294 @@ void HAL_UART_TxCpltCallback(UART_HandleTypeDef* huart)
   switch ((uint32_t) huart->Instance)
   {
 			case USART1_BASE:
-				systemFlag.uartCallback = 1;
+				LinkTxCpltCallback();
 				break;
 			default:
 
 				break;
   }
 }
+void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size)
+{
+  if (huart->Instance == USART1)
+  {
+    LinkRxEventCallback();
+  }
+}
+
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
+{
+  if (huart->Instance == USART1)
+  {
+    LinkErrorCallback();
+  }
+}
+/*** sample tick: read SCH sensor data at the sample rate, or advance its startup ***/
+static void sampleEvent(void)
+{
+    uint32_t start = DWT->CYCCNT;
+
+    SchedulerLatencyProbe(SCHEDULER_PROBE_SAMPLE, SampleRateTicksToUs(TIM2->CNT));
+    PROF_START(PROF_SAMPLE_EVENT);
+
+    if (SCHGetInitState() == SCH_INIT_READY)
+    {
+        readingSCHData_callback();
+        sendingSCHData();
+        SampleRateAddCost(DWT->CYCCNT - start);
+    }
+    else
+    {
+        startingSCH_callback();
+    }
+
+    PROF_END(PROF_SAMPLE_EVENT);
+}
+
+/*** keep the stepper segment queue filled, homing, limit and fault handling ***/
+static void motorEvent(void)
+{
+    MotionPoll();
+    HomingPoll();
+    sendingMotorFault();
+}
+
+/*** periodic reports, lowest priority event before the background steps ***/
+static void housekeepingEvent(void)
+{
+    sendingStatus();
+    sendingHealth();
+    sendingMotionStatus();
+    StatsSend();
+    ZeroMotionSend();
+    TiltSend();
+    CalibrationSend();
+    CaptureSend();
+    TraceDrain();
+}
+
 /*** reading SCH sensor data  ***/
 static void readingSCHData_callback(void)
 {
-    SCHGetData(&SCH1_summed_data_buffer);
-    SCHGetData2(&SCH1_summed_data_buffer);
-    if (SCH1_summed_data_buffer.frameError)
-        SCH1_error_available = true;
+    uint32_t ticks = sampleTicks;
+
+    // Motor state at the instant the sample is read
+    StepperGetTag(&sampleTag);
+    SCHGetSample(&SCH1_summed_data_buffer);
+    SchedulerLatencyProbe(SCHEDULER_PROBE_READ, SampleRateTicksToUs(TIM2->CNT));
 
+    PROF_START(PROF_CONVERT);
     SCHConvertData(&SCH1_summed_data_buffer, &Data);
+    PROF_END(PROF_CONVERT);
+
+    // Ticks merged into one pending sample event while a handler (or a flash
+    // erase) ran longer than a sample period are counted as missed
+    if (!sampleCounterValid) {
+        sampleCounter = ticks;
+        sampleCounterValid = true;
+    } else if ((int32_t)(ticks - sampleCounter) > 1) {
+        missedSamples += ticks - sampleCounter - 1;
+        sampleCounter = ticks;
+    } else {
+        sampleCounter++;
+    }
+
+    PROF_START(PROF_CONTROL);
+    ControllerUpdate(&SCH1_summed_data_buffer);
+    CalibrationUpdate(&SCH1_summed_data_buffer);
+    PROF_END(PROF_CONTROL);
+
+    CaptureUpdate(&SCH1_summed_data_buffer, sampleCounter);
+    StatsUpdate(&SCH1_summed_data_buffer, sampleCounter);
+    FftUpdate(&SCH1_summed_data_buffer);
+    ZeroMotionUpdate(&SCH1_summed_data_buffer);
+    TiltUpdate(&SCH1_summed_data_buffer, sampleCounter);
+    AllanUpdate(&SCH1_summed_data_buffer);
+
+    if ((firstValidSampleMs == 0) && !SCH1_summed_data_buffer.frameError)
+        firstValidSampleMs = HAL_GetTick();
+
+    /***If  SCH sensor has a confirmed fault, it will be restarted. ***/
+    if (SCHFaultConfirmed())
+    {
+        recoveries++;
+        TraceWrite(TRACE_RECOVERY, recoveries);
+        TraceFreeze();
+        ControllerEnable(false);
+        CalibrationAbort();
+        startMode = START_MODE_COLD;
+        SCHInitStart(appConfig.filter, appConfig.sensitivity, appConfig.decimation, appConfig.enableDry);
+    }
 }
 
-/*** TIMER 2  1000HZ Or 1ms ***/
+/*** advance sensor startup, retry without resetting the MCU on failure ***/
+static void startingSCH_callback(void)
+{
+    SCHInitState state = SCHGetInitState();
+
+    sampleCounterValid = false;
+    if (state == SCH_INIT_FAILED)
+    {
+        if ((HAL_GetTick() - initRetryMs) >= INIT_RETRY_DELAY_MS)
+        {
+            startMode = START_MODE_COLD;
+            SCHInitStart(appConfig.filter, appConfig.sensitivity, appConfig.decimation, appConfig.enableDry);
+        }
+        return;
+    }
+
+    state = SCHInitPoll();
+    if (state == SCH_INIT_READY)
+    {
+        /** read serial number sensor**/
+        strcpy(serialNum, SCHGetSnbr());
+    }
+    else if (state == SCH_INIT_FAILED)
+    {
+        initFailures++;
+        initRetryMs = HAL_GetTick();
+    }
+}
+
+/*** periodic status frame, faster while the sensor is starting ***/
+static void sendingStatus(void)
+{
+    PktStatus packet;
+    uint32_t now = HAL_GetTick();
+    uint32_t period = (SCHGetInitState() == SCH_INIT_READY) ? STATUS_PERIOD_RUNNING_MS : STATUS_PERIOD_STARTING_MS;
+
+    if ((now - lastStatusMs) < period)
+        return;
+    lastStatusMs = now;
+
+    packet.uptimeMs = now;
+    packet.firstValidSampleMs = firstValidSampleMs;
+    packet.sensorState = (uint8_t)SCHGetInitState();
+    packet.initAttempt = SCHGetInitAttempt();
+    packet.initFailures = initFailures;
+    packet.startMode = startMode;
+    packet.homingState = (uint8_t)HomingGetState();
+    packet.recoveries = recoveries;
+    LinkSend(PKT_STATUS, &packet, sizeof(packet));
+}
+
+/*** queue every Nth sample for the link, dropped when the link is saturated ***/
+static void sendingSCHData(void)
+{
+    uint8_t buffer[sizeof(PktSample) + sizeof(ControllerTelemetry) + sizeof(StepperTag)];
+    PktSample packet;
+    uint8_t size = sizeof(packet);
+
+    if ((appConfig.streams & STREAM_SAMPLES) == 0)
+        return;
+    if (++outputCounter < appConfig.outputDivider)
+        return;
+    outputCounter = 0;
+
+    PROF_START(PROF_OUTPUT);
+    packet.sampleCounter = sampleCounter;
+    packet.result = Data;
+    packet.health = SCHGetHealthFlags();
+    packet.quality = SCH1_summed_data_buffer.quality;
+    memcpy(buffer, &packet, sizeof(packet));
+
+    // Optional sections in STREAM_xxx bit order
+    if (appConfig.streams & STREAM_CONTROLLER)
+    {
+        ControllerTelemetry telemetry;
+
+        ControllerGetTelemetry(&telemetry);
+        memcpy(&buffer[size], &telemetry, sizeof(telemetry));
+        size += sizeof(telemetry);
+    }
+    if (appConfig.streams & STREAM_STEPPER)
+    {
+        memcpy(&buffer[size], &sampleTag, sizeof(sampleTag));
+        size += sizeof(sampleTag);
+    }
+    LinkSend(PKT_SAMPLE, buffer, size);
+    PROF_END(PROF_OUTPUT);
+}
+
+/*** periodic frame quality and link error counters ***/
+static void sendingHealth(void)
+{
+    PktHealth packet;
+    SCHHealth health;
+    LinkStats stats;
+    SchedulerLatency latency;
+    uint32_t now = HAL_GetTick();
+
+    if (SCHGetInitState() != SCH_INIT_READY)
+        return;
+    if ((now - lastHealthMs) < HEALTH_PERIOD_MS)
+        return;
+    lastHealthMs = now;
+
+    SCHGetQualityWindow(&packet.window);
+    SCHGetHealth(&health);
+    LinkGetStats(&stats);
+    packet.faults = health.faults;
+    packet.confirmed = health.confirmed;
+    packet.cpuLoad = SchedulerGetLoad();
+    packet.statusReads = health.reads;
+    packet.txDropped = stats.txDropped;
+    packet.rxCrcErrors = stats.rxCrcErrors;
+    SchedulerTakeLatency(&latency);
+    packet.tickLatencyMax = latency.windowMax[SCHEDULER_PROBE_TICK_IRQ];
+    packet.tickLatencyPeak = latency.peak[SCHEDULER_PROBE_TICK_IRQ];
+    packet.sampleLatencyMax = latency.windowMax[SCHEDULER_PROBE_SAMPLE];
+    packet.sampleLatencyPeak = latency.peak[SCHEDULER_PROBE_SAMPLE];
+    packet.readLatencyMax = latency.windowMax[SCHEDULER_PROBE_READ];
+    packet.readLatencyPeak = latency.peak[SCHEDULER_PROBE_READ];
+    packet.missedSamples = missedSamples;
+    LinkSend(PKT_HEALTH, &packet, sizeof(packet));
+}
+
+/*** driver fault event, once per latched fault ***/
+static void sendingMotorFault(void)
+{
+    StepperFault fault;
+
+    if (StepperGetFaultEvent(&fault))
+        LinkSend(PKT_MOTOR_FAULT, &fault, sizeof(fault));
+}
+
+/*** block queue state while moving, and once when motion ends ***/
+static void sendingMotionStatus(void)
+{
+    MotionStats stats;
+    uint32_t now = HAL_GetTick();
+    bool busy = MotionIsBusy();
+
+    if (!busy && !motionWasBusy)
+        return;
+    if (busy && ((now - lastMotionStatusMs) < MOTION_STATUS_PERIOD_MS))
+        return;
+    lastMotionStatusMs = now;
+    motionWasBusy = busy;
+
+    MotionGetStats(&stats);
+    LinkSend(PKT_MOTION_STATUS, &stats, sizeof(stats));
+}
+
+/*** TIMER 2 sample tick, SampleRateGet() Hz ***/
 void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
 {
     if (htim == &htim2)
     {
-    	systemFlag.timerCallback = 1;
+    	sampleTicks++;
+    	SchedulerPost(SCHEDULER_EVENT_SAMPLE);
     }
 }
 
+/*** SysTick 1 ms: planner refill and reports, independent of the sample rate ***/
+void HAL_SYSTICK_Callback(void)
+{
+    SchedulerPost(SCHEDULER_EVENT_MOTOR);
+    SchedulerPost(SCHEDULER_EVENT_HOUSEKEEPING);
+}
+
 
 
 
@@ -0,0 +1,154 @@
+#!/usr/bin/env python3
+"""Decode PKT_TRACE frames from a raw link capture into a timeline.
+
+The capture is the byte stream received from USART1 (for example saved with
+a terminal program or `cat /dev/ttyUSB0 > capture.bin`). Frames of other
+types are skipped. Start the trace with CMD_TRACE (stream or dump) first.
+
+    trace_decode.py capture.bin
+    trace_decode.py --late-us 50 capture.bin
+    trace_decode.py --rate 2000 capture.bin
+
+TICK records are expected once per acquisition period; pass the configured
+rate (CMD_SAMPLE_RATE, PKT_SAMPLE_RATE) with --rate when it is not 1 kHz.
+
+Record layout and event numbers follow Core/Src/Sources/Trace.h.
+"""
+
+import argparse
+import struct
+import sys
+
+LINK_SYNC = b"\xa5\x5a"
+PKT_TRACE = 0x0B
+
+CPU_HZ = 64000000
+SAMPLE_RATE_HZ = 1000
+
+HEADER = struct.Struct("<IIHBB")    # index, timeMs, lost, count, frozen
+RECORD = struct.Struct("<IBBH")     # cycles, event, sequence, arg
+
+EVENTS = [
+    "TICK",
+    "SPI_START",
+    "SPI_END",
+    "STATUS_READ",
+    "STATUS_FAULT",
+    "RECOVERY",
+    "TX_START",
+    "TX_DONE",
+    "TX_DROP",
+    "RX_EVENT",
+    "COMMAND",
+    "STEP_DMA",
+    "LIMIT",
+    "MOTOR_FAULT",
+]
+
+
+def crc16(data, crc=0xFFFF):
+    """CRC-16/CCITT, poly 0x1021, as Crc16Update()"""
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if (crc & 0x8000) else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def frames(data):
+    """Yield (type, payload) of every frame with a valid CRC"""
+    pos = 0
+    while True:
+        pos = data.find(LINK_SYNC, pos)
+        if pos < 0 or pos + 4 > len(data):
+            return
+        ptype, length = data[pos + 2], data[pos + 3]
+        end = pos + 4 + length + 2
+        if end > len(data):
+            return
+        payload = data[pos + 4:pos + 4 + length]
+        crc = data[end - 2] | (data[end - 1] << 8)
+        if crc == crc16(data[pos + 2:pos + 4 + length]):
+            yield ptype, payload
+            pos = end
+        else:
+            pos += 1
+
+
+def records(data):
+    """Yield (index, packet header, record) in capture order"""
+    for ptype, payload in frames(data):
+        if ptype != PKT_TRACE or len(payload) < HEADER.size:
+            continue
+        index, time_ms, lost, count, frozen = HEADER.unpack_from(payload)
+        header = {"timeMs": time_ms, "lost": lost, "frozen": frozen, "first": True}
+        for i in range(count):
+            offset = HEADER.size + i * RECORD.size
+            if offset + RECORD.size > len(payload):
+                break
+            yield index + i, header, RECORD.unpack_from(payload, offset)
+            header = dict(header, first=False, lost=0)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("capture", help="raw link capture, - for stdin")
+    parser.add_argument("--clock", type=int, default=CPU_HZ, help="DWT cycle counter clock, Hz")
+    parser.add_argument("--rate", type=float, default=SAMPLE_RATE_HZ,
+                        help="acquisition (TICK) rate, Hz")
+    parser.add_argument("--late-us", type=int, default=0,
+                        help="mark ticks entered later than this after the TIM2 update")
+    args = parser.parse_args()
+
+    if args.capture == "-":
+        data = sys.stdin.buffer.read()
+    else:
+        with open(args.capture, "rb") as f:
+            data = f.read()
+
+    cycles_per_us = args.clock / 1e6
+    tick_period_us = 1e6 / args.rate
+    time = None             # Unwrapped cycle count
+    last_cycles = None
+    last_index = None
+    last_tick = None
+
+    print("%12s %10s  %-12s %s" % ("time_us", "delta_us", "event", "arg"))
+    for index, header, (cycles, event, sequence, arg) in records(data):
+        if header["first"]:
+            if header["lost"]:
+                print("-- %d records lost --" % header["lost"])
+            elif last_index is not None and index != last_index + 1:
+                print("-- gap of %d records --" % (index - last_index - 1))
+            if header["frozen"] and (last_index is None or index != last_index + 1):
+                print("-- frozen ring, sent at %d ms --" % header["timeMs"])
+
+        if (sequence & 0xFF) != (index & 0xFF):
+            print("-- record %d has a bad sequence, skipped --" % index)
+            continue
+
+        if last_cycles is None:
+            time = 0
+            delta = 0
+        else:
+            # Signed difference: records of preempted writers may be slightly out of order
+            delta = ((cycles - last_cycles + 0x80000000) & 0xFFFFFFFF) - 0x80000000
+            time += delta
+        last_cycles = cycles
+        last_index = index
+
+        name = EVENTS[event] if event < len(EVENTS) else "EVENT_%d" % event
+        note = ""
+        if name == "TICK":
+            if args.late_us and arg > args.late_us:
+                note = "  late entry"
+            if last_tick is not None and (time - last_tick) / cycles_per_us > 1.5 * tick_period_us:
+                note += "  missed tick"
+            last_tick = time
+
+        print("%12.1f %10.1f  %-12s %d%s" % (time / cycles_per_us, delta / cycles_per_us, name, arg, note))
+
+
+if __name__ == "__main__":
+    main()